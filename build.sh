@@ -1,7 +1,7 @@
 #!/bin/bash
 
 dst=/tmp
-flags="-std=c++23 -Wall -O3 -Os -s -I . -I ../include -I ../../unp/include -lprotobuf -lpthread"
+flags="-std=c++23 -Wall -O3 -Os -s -I . -I ../include -I ../../unp/include -lprotobuf -lssl -lcrypto -lpthread"
 
 cd example
 
@@ -13,5 +13,13 @@ for p in *.proto; do
     g++ ${flags} ${base}_server.cpp ${base}.pb.cc -o ${dst}/${base}_server
 done
 
-rm -f *.pb.*
+g++ -std=c++23 -Wall -O3 ../plugin/protoc_gen_urpc.cpp -lprotoc -lprotobuf -o ${dst}/protoc-gen-urpc
+
+# the benchmark needs what ring.hpp needs from unp, see the README
+if [ "$1" == "--bench" ]; then
+    protoc --plugin=protoc-gen-urpc=${dst}/protoc-gen-urpc --urpc_out=. ping.proto
+    g++ ${flags} ping_bench.cpp ping.pb.cc -o ${dst}/ping_bench
+fi
+
+rm -f *.pb.* *.urpc.h
 echo Please check the executables at ${dst}
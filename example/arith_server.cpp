@@ -86,7 +86,11 @@ int main(int argc, char* argv[])
 
     service s;
     urpc::server server(ioc, host, port);
-    
+
+    server.limit(urpc::limiter_options());
+    server.connection_limit(64);
+    server.cache("service.compute", urpc::cache_options());
+
     server.register_service(&s, gp::NewPermanentCallback(&done));
     server.run();
 
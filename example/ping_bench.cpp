@@ -0,0 +1,149 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <latch>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <ring.hpp>
+#include <ping.urpc.h>
+
+namespace net = unp;
+namespace gp = google::protobuf;
+
+// sequential pings between a server ring and a client ring in one process, both set up the same way,
+// e.g. ping_bench 127.0.0.1 9000 sqpoll 100000 to compare against ping_bench 127.0.0.1 9000 default 100000;
+// calls go through the stub and skeleton protoc-gen-urpc generates from ping.proto
+
+class service : public pb::service_urpc::skeleton
+{
+public:
+    void execute(gp::RpcController* controller, const pb::request* request, pb::response* response, gp::Closure* done)
+    {
+        response->set_results("pong");
+        done->Run();
+    }
+};
+
+urpc::ring_options options(const std::string& mode, int cpu)
+{
+    urpc::ring_options o;
+
+    if (mode == "sqpoll")
+    {
+        o.sqpoll = true;
+        o.sq_cpu = cpu;
+    }
+    else if (mode == "coop")
+        o.coop_taskrun = true;
+    else if (mode == "defer")
+        o.defer_taskrun = true;
+    else if (mode == "spin")
+        o.spin = 50;
+    else if (mode != "default")
+        throw std::invalid_argument("unknown mode " + mode);
+
+    return o;
+}
+
+urpc::task bench(pb::service_urpc::stub& stub, const std::string& host, const std::string& port, size_t count, std::vector<double>& samples, net::inplace_stop_source& source)
+{
+    pb::request request;
+    request.set_command("ping");
+
+    for (size_t i = 0; i < count; ++i)
+    {
+         urpc::controller controller;
+         pb::response response;
+
+         controller.host(host);
+         controller.port(port);
+
+         auto start = urpc::steady_t::now();
+
+         if (!co_await stub.async_execute(controller, request, response))
+         {
+             std::cerr << "ErrorCode: " << controller.ErrorCode() << " ErrorText: " << controller.ErrorText() << std::endl;
+
+             break;
+         }
+
+         samples.push_back(std::chrono::duration<double, std::micro>(urpc::steady_t::now() - start).count());
+    }
+
+    source.request_stop();
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 5)
+    {
+        std::cout << "Usage: " << argv[0] << " <host> <port> <default|sqpoll|coop|defer|spin> <count>" << std::endl;
+
+        return 1;
+    }
+
+    std::string host(argv[1]);
+    std::string port(argv[2]);
+
+    std::string mode(argv[3]);
+    size_t count = std::stoul(argv[4]);
+
+    net::inplace_stop_source server_source;
+    net::inplace_stop_source client_source;
+
+    std::latch listening(1);
+
+    // a defer_taskrun ring only takes submissions from the thread that created it
+    std::thread t([&]
+    {
+        urpc::ring ring(options(mode, 0));
+
+        service s;
+        urpc::server server(ring, host, port);
+
+        server.register_service(&s, nullptr);
+        server.run();
+
+        listening.count_down();
+        ring.run(server_source.get_token());
+    });
+
+    listening.wait();
+
+    urpc::ring client_ring(options(mode, 1));
+    urpc::channel channel(client_ring);
+    pb::service_urpc::stub stub(channel);
+
+    std::vector<double> samples;
+    samples.reserve(count);
+
+    auto begin = urpc::steady_t::now();
+
+    bench(stub, host, port, count, samples, client_source);
+    client_ring.run(client_source.get_token());
+
+    auto elapsed = std::chrono::duration<double>(urpc::steady_t::now() - begin).count();
+
+    server_source.request_stop();
+    t.join();
+
+    if (samples.empty())
+        return 1;
+
+    std::sort(samples.begin(), samples.end());
+
+    auto at = [&](double q){ return samples[std::min(samples.size() - 1, size_t(q * samples.size()))]; };
+
+    std::cout << mode << ": " << samples.size() << " calls, " << size_t(samples.size() / elapsed) << " calls/s, "
+              << "p50 " << at(0.5) << " us, p99 " << at(0.99) << " us, p999 " << at(0.999) << " us" << std::endl;
+
+    return 0;
+}
@@ -15,16 +15,6 @@
 namespace net = unp;
 namespace gp = google::protobuf;
 
-struct task
-{
-    urpc::controller controller;
-
-    pb::request request;
-    pb::response response;
-
-    urpc::Closure* done;
-};
-
 class client
 {
 public:
@@ -34,30 +24,23 @@ public:
         service = new pb::service::Stub(channel, pb::service::STUB_OWNS_CHANNEL);
     }
 
-    void ping()
+    urpc::task ping()
     {
-        auto t = std::make_shared<task>();
-        auto& controller = t->controller;
+        urpc::controller controller;
+
+        pb::request request;
+        pb::response response;
 
         controller.host(host);
         controller.port(port);
 
         controller.timeout(80);
+        request.set_command("ping");
 
-        t->request.set_command("ping");
-        t->done = gp::NewCallback(this, &client::done, t);
-
-        service->execute(&t->controller, &t->request, &t->response, t->done);
-    }
-
-    void done(std::shared_ptr<task> t)
-    {
-        auto& controller = t->controller;
-
-        if (controller.Failed())
+        if (!co_await urpc::async_call(*service, &pb::service::Stub::execute, controller, request, response))
             std::cerr << "ErrorCode: " << controller.ErrorCode() << " ErrorText: " << controller.ErrorText() << std::endl;
 
-        std::cout << t->response.DebugString();
+        std::cout << response.DebugString();
     }
 
     ~client()
@@ -69,7 +52,7 @@ private:
     net::io_uring_context& ioc;
 
     urpc::channel* channel;
-    pb::service* service;
+    pb::service::Stub* service;
 
     std::string host;
     std::string port;
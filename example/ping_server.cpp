@@ -19,6 +19,11 @@ void done()
     std::cout << "got called" << std::endl;
 }
 
+void slow(const char* where, urpc::duration_t period)
+{
+    std::cerr << where << " blocked the loop for " << std::chrono::duration_cast<std::chrono::microseconds>(period).count() << " us" << std::endl;
+}
+
 class service : public pb::service
 {
 public:
@@ -61,6 +66,9 @@ int main(int argc, char* argv[])
     service s;
     urpc::server server(ioc, host, port);
     
+    server.monitor().budget(std::chrono::milliseconds(1));
+    server.monitor().hook(&slow);
+
     server.register_service(&s, gp::NewPermanentCallback(&done));
     server.run();
 
@@ -7,13 +7,14 @@
 // Official repository: https://github.com/deepgrace/urpc
 //
 
-#include <array>
 #include <deque>
-#include <thread>
+#include <random>
+#include <vector>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
 #include <urpc.hpp>
+#include <delta.hpp>
 #include <transfer.pb.h>
 
 namespace net = unp;
@@ -30,6 +31,8 @@ template <typename T, typename U>
 struct task_type
 {
     uint64_t id;
+    uint32_t stream;
+
     urpc::controller controller;
 
     T request;
@@ -44,21 +47,80 @@ struct task_type
 using data_type_t = task_type<pb::data_req, pb::data_res>;
 using done_type_t = task_type<pb::done_req, pb::done_res>;
 
+using sign_type_t = task_type<pb::sign_req, pb::sign_res>;
+using delta_type_t = task_type<pb::delta_req, pb::data_res>;
+
 using data_task_t = std::shared_ptr<data_type_t>;
 using done_task_t = std::shared_ptr<done_type_t>;
 
+using sign_task_t = std::shared_ptr<sign_type_t>;
+using delta_task_t = std::shared_ptr<delta_type_t>;
+
+// the files of a path are shared out to the streams as they become free, each stream has a connection of its own,
+// files up to a chunk travel whole and many at a time, larger ones chunk by chunk on the stream that took them;
+// in delta mode a larger file the server has a copy of is rebuilt there from blocks of that copy and the bytes it lacks
 class client
 {
 public:
-    client(net::io_uring_context& ioc, net::inplace_stop_source& source, const std::string& host, const std::string& port) : ioc(ioc), source(source), host(host), port(port)
+    struct entry
     {
-        channel = new urpc::channel(ioc);
-        service = new pb::service::Stub(channel, pb::service::STUB_OWNS_CHANNEL);
-    }
+        fs::path path;
+        std::string name;
+
+        uintmax_t size;
+        uint32_t perms;
+
+        // sent in full, after its delta failed to rebuild it
+        bool whole = false;
+    };
+
+    struct syncing
+    {
+        syncing(entry file, urpc::mapping source, const pb::sign_res& res) :
+        file(std::move(file)), source(std::move(source)), sigs(res.block()), walker(this->source.data(), this->source.size(), sigs)
+        {
+            for (int i = 0; i != res.weak_size(); ++i)
+                 sigs.add(res.weak(i), res.strong(i));
+        }
+
+        entry file;
+        urpc::mapping source;
+
+        urpc::signatures sigs;
+        urpc::delta walker;
+
+        urpc::digest whole;
+    };
 
-    bool eof(const std::string& file)
+    struct stream
     {
-        return fin.gcount() != size || fs::file_size(file) == size;
+        std::unique_ptr<pb::service::Stub> service;
+        std::unique_ptr<syncing> sync;
+
+        entry file;
+
+        std::ifstream fin;
+        std::string name;
+
+        uintmax_t size = 0;
+        uintmax_t left = 0;
+
+        uint32_t perms = 0;
+
+        uint64_t data_id = 0;
+        uint64_t done_id = 0;
+
+        bool busy = false;
+    };
+
+    client(net::io_uring_context& ioc, net::inplace_stop_source& source, const std::string& host, const std::string& port, uint32_t count, bool delta) :
+    ioc(ioc), source(source), host(host), port(port), streams(std::max<uint32_t>(count, 1)), delta(delta)
+    {
+        for (auto& s : streams)
+             s.service = std::make_unique<pb::service::Stub>(new urpc::channel(ioc), pb::service::STUB_OWNS_CHANNEL);
+
+        std::random_device rd;
+        session = uint64_t(rd()) << 32 | rd();
     }
 
     std::string relative(const fs::path& path)
@@ -69,133 +131,268 @@ public:
         return fs::relative(path, parent_);
     }
 
-    template <typename T>
-    void set_last(T& t, const fs::path& path)
+    uint32_t perms(const fs::path& path)
+    {
+        return std::to_underlying(fs::status(path).permissions());
+    }
+
+    void add(const fs::path& path, bool dir)
     {
-        set_perms(t, path);
-        last = relative(path);
+        auto name = relative(path);
 
-        std::cout << "transferring " << last << std::endl;
+        if (dir)
+            items.emplace_back(path, name + "/", 0, perms(path));
+        else
+            items.emplace_back(path, name, fs::file_size(path), perms(path));
     }
 
+    // directories travel only when empty, the server creates the parents of a file on its own
     void init(const fs::path& path)
     {
         path_ = path;
         parent_ = path_.parent_path();
 
-        auto value = !fs::is_directory(path_);
-        range = value ? iterator_t() : iterator_t(path_);
-
-        begin = value ? iterator_t() : fs::begin(range);
-        end = value ? iterator_t() : fs::end(range);
-    }
+        if (fs::is_regular_file(path_))
+            add(path_, false);
+        else if (fs::is_directory(path_))
+        {
+            if (fs::is_empty(path_))
+                add(path_, true);
 
-    template <typename T>
-    void set_perms(T& t, const fs::path& path)
-    {
-        fs::file_status s = fs::status(path); 
-        t.set_perms(std::to_underlying(s.permissions()));
+            for (auto& e : iterator_t(path_))
+            {
+                 if (e.is_directory() && fs::is_empty(e.path()))
+                     add(e.path(), true);
+                 else if (e.is_regular_file())
+                     add(e.path(), false);
+            }
+        }
     }
 
     template <typename S, typename R, typename C, typename... Args, typename T>
     void invoke(S& s, R (C::*m)(Args...), T& t)
     {
-        (s->*m)(&t->controller, &t->request, &t->response, t->done);
+        (s.get()->*m)(&t->controller, &t->request, &t->response, t->done);
     }
 
     template <typename T, typename R, typename C, typename... Args>
-    void fill(T& task, uint64_t id, R (C::*m)(Args...))
+    void fill(T& task, uint32_t stream, uint64_t id, R (C::*m)(Args...))
     {
         task->id = id;
+        task->stream = stream;
+
         auto& controller = task->controller;
 
         controller.host(host);
         controller.port(port);
 
         controller.timeout(80);
+
         task->request.set_id(id);
+        task->request.set_session(session);
+        task->request.set_stream(stream);
 
         task->time_begin = steady_t::now();
         task->done = gp::NewCallback(this, m, task);
     }
 
-    void transfer(pb::data_req& req)
+    // a call that makes the server write gets on top of the 80ms the time to write it at 10MiB/s,
+    // and a millisecond per file for its open and close
+    static uint32_t deadline(uint64_t bytes, uint64_t files)
     {
-        auto path = begin->path();
+        return 80 + bytes * 100 / (1 << 20) + files;
+    }
 
-        while (fs::is_directory(path) && !fs::is_empty(path))
-        {
-            ++begin;
-            path = begin->path();
-        }
+    void read(std::ifstream& fin, std::string* data, size_t n)
+    {
+        data->resize(n);
+        fin.read(data->data(), n);
 
-        if (fs::is_directory(path))
-        {
-            set_last(req, path);
-            req.set_name(last + "/");
-        }
-        else if (fs::is_regular_file(path))
-            transfer(req, path);
+        data->resize(fin.gcount());
     }
 
-    void transfer(pb::data_req& req, const fs::path& path)
+    void open(stream& s, const entry& e)
     {
-        if (!fs::file_size(path))
-            set_last(req, path);
-        else
+        s.name = e.name;
+
+        s.size = e.size;
+        s.left = e.size;
+        s.perms = e.perms;
+
+        s.fin.open(e.path, std::ios_base::in | std::ios_base::binary);
+        std::cout << "transferring " << e.name << std::endl;
+    }
+
+    void next_chunk(stream& s, pb::data_req& req)
+    {
+        auto n = std::min<uintmax_t>(s.left, chunk);
+        read(s.fin, req.mutable_data(), n);
+
+        if (s.left == s.size)
+            req.set_size(s.size);
+
+        req.set_name(s.name);
+        req.set_perms(s.perms);
+
+        if (s.left -= n; !s.left || !s.fin)
+            s.fin.close();
+    }
+
+    // fills req with the next chunk of the file the stream is on, or packs the small files at the front of the queue,
+    // false once there is nothing left for the stream
+    bool next(stream& s, pb::data_req& req)
+    {
+        if (s.fin.is_open())
         {
-            if (!fin.is_open())
+            next_chunk(s, req);
+
+            return true;
+        }
+
+        uintmax_t bytes = 0;
+
+        while (!items.empty())
+        {
+            auto& e = items.front();
+
+            if (e.size > chunk)
             {
-                set_last(req, path);
-                fin.open(path, std::ios_base::in | std::ios_base::binary);
+                if (req.files_size())
+                    break;
+
+                open(s, e);
+                items.pop_front();
+                next_chunk(s, req);
+
+                return true;
             }
 
-            fin.read(buffer.data(), buffer.size());
-            req.set_data(buffer.data(), fin.gcount());
+            if (req.files_size() && (bytes + e.size > pack || req.files_size() == entries))
+                break;
+
+            auto f = req.add_files();
+
+            f->set_name(e.name);
+            f->set_perms(e.perms);
+
+            if (e.size)
+            {
+                std::ifstream fin(e.path, std::ios_base::in | std::ios_base::binary);
+                read(fin, f->mutable_data(), e.size);
+            }
+
+            bytes += e.size;
+            items.pop_front();
         }
 
-        req.set_name(last);
+        if (req.files_size())
+            std::cout << "transferring " << req.files_size() << " files from " << req.files(0).name() << std::endl;
+
+        return req.files_size();
+    }
+
+    void start()
+    {
+        if (paths.empty())
+            return stop();
+
+        init(paths.front());
+
+        for (uint32_t i = 0; i != streams.size(); ++i)
+             do_data_transfer(i);
+
+        if (!busy)
+            do_done_transfer();
     }
 
     void transfer(const fs::path& path)
     {
-        bool write_in_progress = !paths.empty();
         paths.push_back(path);
+    }
+
+    void engage(stream& s)
+    {
+        if (!std::exchange(s.busy, true))
+            ++busy;
+    }
+
+    void do_data_transfer(uint32_t i)
+    {
+        auto& s = streams[i];
+
+        if (delta && !s.fin.is_open() && !items.empty() && items.front().size > chunk && !items.front().whole)
+        {
+            engage(s);
+
+            s.file = std::move(items.front());
+            items.pop_front();
+
+            return do_sign_transfer(i);
+        }
+
+        auto task = std::make_shared<data_type_t>();
+        fill(task, i, s.data_id + 1, &client::on_data_transfer);
 
-        if (!write_in_progress)
+        if (!next(s, task->request))
         {
-            init(paths.front());
-            do_data_transfer();
+            delete task->done;
+
+            if (std::exchange(s.busy, false) && !--busy)
+                do_done_transfer();
+
+            return;
         }
+
+        engage(s);
+        ++s.data_id;
+
+        auto& req = task->request;
+        task->controller.timeout(deadline(req.ByteSizeLong(), req.files_size() + 1));
+
+        invoke(s.service, &pb::service::data_transfer, task);
     }
 
-    void do_data_transfer()
+    void on_data_transfer(data_task_t task)
     {
-        auto task = std::make_shared<data_type_t>();
-        fill(task, ++data_id, &client::on_data_transfer);
+        task->time_end = steady_t::now();
+        auto& controller = task->controller;
 
         auto& req = task->request;
+        auto& res = task->response;
 
-        if (begin != end)
-            transfer(req);
-        else if (fs::is_regular_file(path_))
-            transfer(req, path_);
-        else if (fs::is_directory(path_))
+        if (controller.Failed())
         {
-            set_last(req, path_);
-            req.set_name(last + "/");
+            std::cerr << "ErrorCode: " << controller.ErrorCode() << " ErrorText: " << controller.ErrorText() << std::endl;
+
+            return stop();
         }
+
+        if (res.success())
+            do_data_transfer(task->stream);
         else
         {
-            std::cerr << "cannot transfer '" << path_ << "': No such file or directory" << std::endl;
+            std::cerr << "transfer " << req.id() << " of stream " << task->stream << " failed" << std::endl;
 
-            return;
+            stop();
         }
+    }
+
+    // the server hashes its whole copy before it answers, hence no timeout
+    void do_sign_transfer(uint32_t i)
+    {
+        auto& s = streams[i];
+
+        auto task = std::make_shared<sign_type_t>();
+        fill(task, i, ++s.data_id, &client::on_sign_transfer);
 
-        invoke(service, &pb::service::data_transfer, task);
+        task->controller.timeout(0);
+        task->request.set_name(s.file.name);
+
+        invoke(s.service, &pb::service::sign_transfer, task);
     }
 
-    void on_data_transfer(data_task_t task)
+    // without a copy on the server there is nothing to copy blocks from, the file goes in chunks as usual
+    void on_sign_transfer(sign_task_t task)
     {
         task->time_end = steady_t::now();
         auto& controller = task->controller;
@@ -207,50 +404,137 @@ public:
         {
             std::cerr << "ErrorCode: " << controller.ErrorCode() << " ErrorText: " << controller.ErrorText() << std::endl;
 
-            return;
+            return stop();
         }
 
-        if (begin != end)
+        if (!res.success())
         {
-            auto path = begin->path();
+            std::cerr << "transfer " << req.id() << " of stream " << task->stream << " failed" << std::endl;
 
-            if (fs::is_directory(path))
-                ++begin;
-            else if (fs::is_regular_file(path) && eof(path))
-            {
-                ++begin;
-                fin.close();
-            }
+            return stop();
         }
 
-        if (res.success())
+        auto& s = streams[task->stream];
+        urpc::mapping source(s.file.path);
+
+        if (!res.weak_size() || !source)
         {
-            if (begin == end)
+            open(s, s.file);
+
+            return do_data_transfer(task->stream);
+        }
+
+        std::cout << "syncing " << s.file.name << std::endl;
+        s.sync = std::make_unique<syncing>(std::move(s.file), std::move(source), res);
+
+        do_delta_transfer(task->stream);
+    }
+
+    // adjacent blocks of the old copy merge into one op, the digest of the whole file rides on the last request
+    void do_delta_transfer(uint32_t i)
+    {
+        auto& s = streams[i];
+        auto& y = *s.sync;
+
+        auto task = std::make_shared<delta_type_t>();
+        fill(task, i, ++s.data_id, &client::on_delta_transfer);
+
+        auto& req = task->request;
+
+        req.set_name(y.file.name);
+        req.set_perms(y.file.perms);
+
+        uint64_t bytes = 0;
+
+        auto literal = [&](const char* data, size_t n)
+        {
+            req.add_ops()->set_data(data, n);
+            y.whole.update(data, n);
+
+            bytes += n;
+        };
+
+        auto copy = [&](uint64_t block, const char* data)
+        {
+            auto ops = req.mutable_ops();
+
+            if (auto size = ops->size(); size && ops->Get(size - 1).count() && ops->Get(size - 1).block() + ops->Get(size - 1).count() == block)
+                ops->Mutable(size - 1)->set_count(ops->Get(size - 1).count() + 1);
+            else
             {
-                if (fs::is_regular_file(path_))
-                {
-                    if (eof(path_))
-                        fin.close();
-                    else
-                        return do_data_transfer();
-                }
+                auto op = ops->Add();
 
-                do_done_transfer();
+                op->set_block(block);
+                op->set_count(1);
             }
-            else
-                do_data_transfer();
+
+            y.whole.update(data, y.sigs.block());
+            bytes += y.sigs.block();
+        };
+
+        if (!y.walker.next(chunk, span, literal, copy))
+            req.set_digest(y.whole.final());
+
+        task->controller.timeout(deadline(bytes, 1));
+
+        invoke(s.service, &pb::service::delta_transfer, task);
+    }
+
+    // a file the server failed to rebuild goes again in full
+    void on_delta_transfer(delta_task_t task)
+    {
+        task->time_end = steady_t::now();
+        auto& controller = task->controller;
+
+        auto& req = task->request;
+        auto& res = task->response;
+
+        if (controller.Failed())
+        {
+            std::cerr << "ErrorCode: " << controller.ErrorCode() << " ErrorText: " << controller.ErrorText() << std::endl;
+
+            return stop();
         }
-        else
-            std::cerr << "transfer " << req.id() << " failed" << std::endl;
+
+        auto& s = streams[task->stream];
+
+        if (!res.success())
+        {
+            std::cerr << "delta " << req.id() << " of stream " << task->stream << " failed, resending " << req.name() << std::endl;
+
+            s.sync->file.whole = true;
+            items.push_front(std::move(s.sync->file));
+        }
+        else if (!req.has_digest())
+            return do_delta_transfer(task->stream);
+
+        s.sync.reset();
+        do_data_transfer(task->stream);
     }
 
+    // every stream that sent data closes its state on the server, the last one to do so ends the path there
     void do_done_transfer()
     {
-        auto task = std::make_shared<done_type_t>();
-        fill(task, ++done_id, &client::on_done_transfer);
+        auto name = relative(path_);
+
+        for (uint32_t i = 0; i != streams.size(); ++i)
+        {
+             auto& s = streams[i];
+
+             if (!s.data_id)
+                 continue;
 
-        task->request.set_name(last);
-        invoke(service, &pb::service::done_transfer, task);
+             auto task = std::make_shared<done_type_t>();
+             fill(task, i, ++s.done_id, &client::on_done_transfer);
+
+             task->request.set_name(name);
+             invoke(s.service, &pb::service::done_transfer, task);
+
+             ++closing;
+        }
+
+        if (!closing)
+            on_done();
     }
 
     void on_done_transfer(done_task_t task)
@@ -265,98 +549,110 @@ public:
         {
             std::cerr << "ErrorCode: " << controller.ErrorCode() << " ErrorText: " << controller.ErrorText() << std::endl;
 
-            return;
+            return stop();
         }
 
-        if (res.success())
+        if (!res.success())
         {
-            data_id = 0;
-            done_id = 0;
+            std::cerr << "transfer " << req.id() << " of stream " << task->stream << " failed" << std::endl;
 
-            if (paths.pop_front(); paths.empty())
-                stop();
-            else
-            {
-                init(paths.front());
-                do_data_transfer();
-            }
+            return stop();
         }
-        else
-            std::cerr << "transfer " << req.id() << " failed" << std::endl;
+
+        if (!--closing)
+            on_done();
     }
 
-    void stop()
+    void on_done()
     {
-        source.request_stop();
+        for (auto& s : streams)
+        {
+             s.data_id = 0;
+             s.done_id = 0;
+        }
+
+        paths.pop_front();
+        start();
     }
 
-    ~client()
+    void stop()
     {
-        delete service;
+        source.request_stop();
     }
 
 private:
     net::io_uring_context& ioc;
     net::inplace_stop_source& source;
 
-    urpc::channel* channel;
-    pb::service* service;
-
     std::string host;
     std::string port;
 
     fs::path path_;
     fs::path parent_;
 
-    std::string last;
-    iterator_t range;
-
-    iterator_t begin;
-    iterator_t end;
+    std::vector<stream> streams;
+    std::deque<entry> items;
 
-    std::ifstream fin;
     std::deque<fs::path> paths;
 
-    uint64_t data_id = 0;
-    uint64_t done_id = 0;
+    uint64_t session;
+    bool delta;
+
+    size_t busy = 0;
+    size_t closing = 0;
 
-    static constexpr int size = 65536;
-    std::array<char, size> buffer;
+    // files above chunk bytes are sent in chunks, smaller ones are packed up to pack bytes or entries files a request
+    static constexpr uintmax_t chunk = 65536;
+    static constexpr uintmax_t pack = 1 << 20;
+
+    static constexpr int entries = 4096;
+
+    // bytes of the file a delta request covers at most when its blocks match
+    static constexpr uintmax_t span = 64 << 20;
 };
 
 int main(int argc, char* argv[])
 {
-    if (argc < 4)
+    int i = 3;
+
+    bool delta = false;
+    uint32_t streams = 4;
+
+    for (; i < argc && argv[i][0] == '-'; ++i)
+    {
+         if (std::string(argv[i]) == "-d")
+             delta = true;
+         else if (std::string(argv[i]) == "-j" && i + 1 < argc)
+             streams = std::stoul(argv[++i]);
+         else
+             break;
+    }
+
+    if (argc <= i)
     {
-        std::cout << "Usage: " << argv[0] << " <host> <port> <path> [<path> ...]" << std::endl;
+        std::cout << "Usage: " << argv[0] << " <host> <port> [-j <streams>] [-d] <path> [<path> ...]" << std::endl;
 
         return 1;
     }
 
-    bool called = false;
-
     std::string host(argv[1]);
     std::string port(argv[2]);
 
     net::io_uring_context ioc;
     net::inplace_stop_source source;
 
-    client c(ioc, source, host, port);
-    std::thread t([&]{ ioc.run(source.get_token()); });
+    client c(ioc, source, host, port, streams, delta);
 
-    for (int i = 3; i != argc; ++i)
+    for (; i != argc; ++i)
     {
          if (auto path = fs::path(argv[i]); fs::exists(path))
-         {
-             called = true;
              c.transfer(path);
-         }
+         else
+             std::cerr << "cannot transfer '" << path << "': No such file or directory" << std::endl;
     }
 
-    if (!called)
-        c.stop();
-
-    t.join();
+    c.start();
+    ioc.run(source.get_token());
 
     return 0;
 }
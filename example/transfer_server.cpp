@@ -7,10 +7,12 @@
 // Official repository: https://github.com/deepgrace/urpc
 //
 
-#include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <unordered_map>
 #include <urpc.hpp>
+#include <file.hpp>
+#include <delta.hpp>
 #include <transfer.pb.h>
 
 namespace net = unp;
@@ -47,10 +49,83 @@ void done()
 {
 }
 
+// a request is answered once every file operation it started finished, with whether all of them succeeded
+struct completion : std::enable_shared_from_this<completion>
+{
+    completion(std::function<void(bool)> finish) : finish(std::move(finish))
+    {
+    }
+
+    urpc::file_ring::handler_t hold()
+    {
+        ++pending;
+
+        return [self = shared_from_this()](int r)
+        {
+            self->release(r);
+        };
+    }
+
+    void release(int r)
+    {
+        if (r < 0)
+            result = false;
+
+        if (!--pending)
+            finish(result);
+    }
+
+    std::function<void(bool)> finish;
+
+    size_t pending = 1;
+    bool result = true;
+};
+
+using completion_t = std::shared_ptr<completion>;
+
+// files are written through the file ring of the server loop, so a slow disk holds up the stream writing to it
+// and not every other connection; replies go out once the data is written
 class service : public pb::service
 {
 public:
-    service(const fs::path& path)
+    // what a stream of a client is writing, a session is the set of streams of one client; a client sends the
+    // next request of a stream only after the reply to the previous one, so no operation is in flight between them
+    struct stream
+    {
+        std::string last;
+
+        // the chunked file being written and where its next chunk goes
+        int fd = -1;
+        uint64_t offset = 0;
+
+        bool direct = false;
+        bool padded = false;
+
+        // the old copy being synced and its replacement, renamed over it once the digests agree
+        urpc::mapping old;
+        uint32_t block = 0;
+
+        std::string partial;
+
+        int part = -1;
+        uint64_t written = 0;
+
+        urpc::digest whole;
+    };
+
+    using streams_t = std::unordered_map<uint32_t, stream>;
+
+    // a client that went away mid transfer never sends done, its streams are let go once they sat idle for a while
+    struct session
+    {
+        streams_t streams;
+
+        urpc::time_point_t used;
+        size_t busy = 0;
+    };
+
+    service(net::io_uring_context& ioc, const fs::path& path, bool direct) : ioc(ioc), ring(urpc::file_ring::of(ioc)), files(*ring), direct(direct),
+    beat(ioc, idle / 10, [this](urpc::time_point_t now){ expire(now); })
     {
         fs::create_directories(path);
         chdir(path.c_str());
@@ -65,7 +140,25 @@ public:
         done->Run();
     }
 
-    constexpr decltype(auto) upon_transfer(const std::string& name, bool b)
+    // the session of req is kept while the reply is pending
+    template <typename T, typename U>
+    completion_t reply(const T* req, U* res, gp::Closure* done)
+    {
+        ++sessions[req->session()].busy;
+
+        return std::make_shared<completion>([this, req, res, done](bool result)
+        {
+            if (auto it = sessions.find(req->session()); it != sessions.end())
+            {
+                --it->second.busy;
+                it->second.used = urpc::steady_t::now();
+            }
+
+            set_res(req, res, done, result);
+        });
+    }
+
+    decltype(auto) upon_transfer(const std::string& name, bool b)
     {
         auto p = name.find_first_of('/');
 
@@ -75,56 +168,370 @@ public:
         return on_transfer(name.substr(0, p + b), b);
     }
 
+    template <typename T>
+    stream& state(const T* req, const std::string& name)
+    {
+        auto [it, fresh] = sessions.try_emplace(req->session());
+
+        if (fresh)
+            upon_transfer(name, true);
+
+        it->second.used = urpc::steady_t::now();
+
+        return it->second.streams[req->stream()];
+    }
+
+    // runs then once the parent directories of name exist
+    void parents(const std::string& name, urpc::file_ring::handler_t then)
+    {
+        if (auto parent = fs::path(name).parent_path(); !parent.empty())
+            files.mkdirs(parent, 0777, std::move(then));
+        else
+            then(0);
+    }
+
+    // chmod only touches the inode, there is no io_uring operation for it
+    void create(const std::string& name, uint32_t perms, int flags, urpc::file_ring::handler_t then)
+    {
+        parents(name, [this, name, perms, flags, then = std::move(then)](int r) mutable
+        {
+            if (r < 0)
+                return then(r);
+
+            files.openat(AT_FDCWD, name, O_WRONLY | O_CREAT | O_TRUNC | flags, perms & 07777, [this, name, perms, flags, then = std::move(then)](int fd) mutable
+            {
+                if (fd == -EINVAL && flags & O_DIRECT)
+                    return create(name, perms, flags & ~O_DIRECT, std::move(then));
+
+                if (fd >= 0)
+                    ::fchmod(fd, perms & 07777);
+
+                then(fd);
+            });
+        });
+    }
+
+    // a packed file is complete, so it replaces whatever was there
+    void store(const pb::file& file, const completion_t& c)
+    {
+        std::string name = file.name();
+
+        if (name.empty())
+            return;
+
+        std::cout << "receiving " << name << std::endl;
+
+        if (name.back() == '/')
+        {
+            name.pop_back();
+
+            return files.mkdirs(name, 0777, [name, perms = file.perms(), h = c->hold()](int r)
+            {
+                if (r == 0)
+                    ::chmod(name.c_str(), perms & 07777);
+
+                h(r);
+            });
+        }
+
+        create(name, file.perms(), 0, [this, &file, h = c->hold()](int fd)
+        {
+            if (fd < 0)
+                return h(fd);
+
+            auto& data = file.data();
+
+            files.write_all(fd, data.data(), data.size(), 0, [this, fd, h](int r)
+            {
+                files.close(fd, [h, r](int)
+                {
+                    h(r);
+                });
+            });
+        });
+    }
+
+    // O_DIRECT takes whole aligned blocks from aligned memory, the padding is cut off in finish, also when a later
+    // unaligned chunk turned O_DIRECT off
+    void put(stream& s, const std::string& data, urpc::file_ring::handler_t h)
+    {
+        auto offset = s.offset;
+        s.offset += data.size();
+
+        if (s.direct && offset % alignment)
+        {
+            s.direct = false;
+            ::fcntl(s.fd, F_SETFL, ::fcntl(s.fd, F_GETFL) & ~O_DIRECT);
+        }
+
+        if (!s.direct)
+            return files.write_all(s.fd, data.data(), data.size(), offset, std::move(h));
+
+        s.padded = true;
+        auto b = std::make_shared<urpc::aligned_buffer>(data.size(), alignment);
+
+        if (!b->data)
+            return h(-ENOMEM);
+
+        std::memcpy(b->data.get(), data.data(), data.size());
+        std::memset(b->data.get() + data.size(), 0, b->size - data.size());
+
+        files.write_all(s.fd, b->data.get(), b->size, offset, [b, h = std::move(h)](int r)
+        {
+            h(r);
+        });
+    }
+
+    void finish(stream& s)
+    {
+        if (s.fd == -1)
+            return;
+
+        if (s.padded)
+            ::ftruncate(s.fd, s.offset);
+
+        files.close(std::exchange(s.fd, -1), [](int){});
+
+        s.offset = 0;
+
+        s.direct = false;
+        s.padded = false;
+    }
+
+    // a new file is created and, with its size known, preallocated before its first chunk is written
+    void begin(stream& s, const pb::data_req* req, const completion_t& c)
+    {
+        finish(s);
+
+        create(req->name(), req->perms(), direct ? O_DIRECT : 0, [this, &s, req, h = c->hold()](int fd)
+        {
+            if (fd < 0)
+                return h(fd);
+
+            s.fd = fd;
+            s.direct = direct && ::fcntl(fd, F_GETFL) & O_DIRECT;
+
+            auto write = [this, &s, req, h](int)
+            {
+                put(s, req->data(), h);
+            };
+
+            if (req->size())
+                files.fallocate(fd, 0, 0, req->size(), write);
+            else
+                write(0);
+        });
+    }
+
     void data_transfer(gp::RpcController* controller, const pb::data_req* req, pb::data_res* res, gp::Closure* done)
     {
         std::string name = req->name();
-
         size_t size = name.size();
-        set_res(req, res, done, size);
 
-        if (!size)
-            return;
+        if (!size && !req->files_size())
+            return set_res(req, res, done, false);
 
-        if (req->id() == 1)
-            upon_transfer(name, true);
+        auto& s = state(req, size ? name : req->files(0).name());
+        auto c = reply(req, res, done);
 
-        bool set_perms = false;
-        bool is_dir = name.back() == '/';
+        for (auto& file : req->files())
+             store(file, c);
 
-        if (is_dir)
-            name.pop_back();
+        if (size)
+        {
+            if (name.back() == '/')
+            {
+                name.pop_back();
+
+                files.mkdirs(name, 0777, [name, perms = req->perms(), h = c->hold()](int r)
+                {
+                    if (r == 0)
+                        ::chmod(name.c_str(), perms & 07777);
+
+                    h(r);
+                });
+            }
+            else if (name != s.last || s.fd == -1)
+            {
+                s.last = name;
+                std::cout << "receiving " << name << std::endl;
+
+                begin(s, req, c);
+            }
+            else
+                put(s, req->data(), c->hold());
+        }
+
+        c->release(0);
+    }
+
+    // signatures of the whole blocks of the copy the server has, none if it has none
+    void sign_transfer(gp::RpcController* controller, const pb::sign_req* req, pb::sign_res* res, gp::Closure* done)
+    {
+        std::string name = req->name();
 
-        if (name != last)
+        if (name.empty())
+            return set_res(req, res, done, false);
+
+        auto& s = state(req, name);
+        auto c = reply(req, res, done);
+
+        s.old = urpc::mapping(name);
+        s.block = urpc::block_size(s.old.size());
+
+        res->set_block(s.block);
+
+        sign(s, res, std::make_shared<net::steady_timer>(ioc), 0, c->hold());
+        c->release(0);
+    }
+
+    // the old copy is signed a slice per turn of the loop, which serves the other connections in between
+    // while the kernel reads the next slice ahead
+    void sign(stream& s, pb::sign_res* res, std::shared_ptr<net::steady_timer> timer, uint64_t offset, urpc::file_ring::handler_t h)
+    {
+        uint64_t n = std::min<uint64_t>(s.old.size() - offset, slice / s.block * s.block);
+
+        urpc::sign(s.old.data() + offset, n, s.block, [res](uint32_t weak, const std::string& strong)
+        {
+            res->add_weak(weak);
+            res->add_strong(strong);
+        });
+
+        if (offset += n; offset + s.block > s.old.size())
+            return h(0);
+
+        s.old.prefetch(offset, slice);
+        timer->expires_from_now(std::chrono::milliseconds(0));
+
+        timer->async_wait([this, &s, res, timer, offset, h = std::move(h)](std::error_code ec)
         {
-            last = name;
-            set_perms = true;
+            sign(s, res, timer, offset, std::move(h));
+        });
+    }
+
+    void discard(stream& s)
+    {
+        if (s.part != -1)
+            files.close(std::exchange(s.part, -1), [](int){});
+
+        files.unlinkat(AT_FDCWD, s.partial, 0, [](int){});
+
+        s.old.reset();
+        s.whole.final();
+
+        s.written = 0;
+    }
+
+    // ops rebuild the file next to the old copy, which only gets replaced once the digest of the result matches
+    void delta_transfer(gp::RpcController* controller, const pb::delta_req* req, pb::data_res* res, gp::Closure* done)
+    {
+        std::string name = req->name();
+
+        if (name.empty())
+            return set_res(req, res, done, false);
+
+        auto& s = state(req, name);
+        auto c = reply(req, res, done);
 
+        if (s.part != -1)
+            apply(s, req, c);
+        else
+        {
             std::cout << "receiving " << name << std::endl;
+            s.partial = name + ".delta";
+
+            files.openat(AT_FDCWD, s.partial, O_WRONLY | O_CREAT | O_TRUNC, 0600, [this, &s, req, c, h = c->hold()](int fd)
+            {
+                if (fd < 0)
+                {
+                    discard(s);
+
+                    return h(fd);
+                }
+
+                s.part = fd;
+                apply(s, req, c);
+
+                h(0);
+            });
         }
 
-        if (is_dir)
-            fs::create_directories(name);
-        else
+        c->release(0);
+    }
+
+    void apply(stream& s, const pb::delta_req* req, const completion_t& c)
+    {
+        auto w = std::make_shared<completion>([this, &s, req, h = c->hold()](bool result)
         {
-            if (set_perms)
+            if (!result)
             {
-                if (auto parent = fs::path(name).parent_path(); !parent.empty())
-                    fs::create_directories(parent);
+                discard(s);
+
+                return h(-EIO);
+            }
+
+            if (!req->has_digest())
+                return h(0);
 
-                if (fout.is_open())
-                    fout.close();
+            if (s.whole.final() != req->digest())
+            {
+                discard(s);
 
-                fout.open(name, std::ios_base::app | std::ios_base::binary);
+                return h(-EIO);
             }
 
-            auto& data = req->data();
-            fout.write(data.c_str(), data.size());
+            s.old.reset();
+
+            files.close(std::exchange(s.part, -1), [this, &s, req, h](int r)
+            {
+                if (r < 0)
+                {
+                    discard(s);
+
+                    return h(r);
+                }
+
+                files.renameat(AT_FDCWD, s.partial, AT_FDCWD, req->name(), [name = req->name(), perms = req->perms(), h](int r)
+                {
+                    if (r == 0)
+                        ::chmod(name.c_str(), perms & 07777);
+
+                    h(r);
+                });
+            });
+        });
+
+        bool result = static_cast<bool>(s.old);
+
+        for (auto& op : req->ops())
+        {
+             if (!result)
+                 break;
+
+             const char* data = op.data().data();
+             uint64_t n = op.data().size();
+
+             if (op.count())
+             {
+                 uint64_t blocks = s.old.size() / s.block;
+
+                 if (result = op.block() < blocks && op.count() <= blocks - op.block(); !result)
+                     break;
+
+                 data = s.old.data() + op.block() * s.block;
+                 n = uint64_t(op.count()) * s.block;
+             }
+
+             files.write_all(s.part, data, n, s.written, w->hold());
+             s.whole.update(data, n);
+
+             s.written += n;
         }
 
-        if (set_perms)
-            fs::permissions(name, fs::perms(req->perms()));
+        w->release(result ? 0 : -EINVAL);
     }
 
+    // the last stream of a session to finish ends the transfer of the path
     void done_transfer(gp::RpcController* controller, const pb::done_req* req, pb::done_res* res, gp::Closure* done)
     {
         std::string name = req->name();
@@ -135,25 +542,74 @@ public:
         if (!size)
             return;
 
-        if (fout.is_open())
-            fout.close();
+        if (auto it = sessions.find(req->session()); it != sessions.end())
+        {
+            auto& streams = it->second.streams;
+
+            if (auto i = streams.find(req->stream()); i != streams.end())
+            {
+                finish(i->second);
+                streams.erase(i);
+            }
+
+            if (streams.empty())
+            {
+                sessions.erase(it);
+                upon_transfer(name, false);
+            }
+        }
+    }
+
+    // the files of an abandoned session stay as far as they got, a partial delta is removed
+    void expire(urpc::time_point_t now)
+    {
+        for (auto it = sessions.begin(); it != sessions.end();)
+        {
+             auto& x = it->second;
+
+             if (x.busy || now - x.used < std::chrono::milliseconds(idle))
+             {
+                 ++it;
+                 continue;
+             }
 
-        upon_transfer(name, false);
+             for (auto& [_, s] : x.streams)
+             {
+                  finish(s);
+
+                  if (s.part != -1)
+                      discard(s);
+             }
+
+             std::cout << "abandoned session " << it->first << std::endl;
+             it = sessions.erase(it);
+        }
     }
 
     ~service()
     {
     }
 
-    std::string last;
-    std::ofstream fout;
+    net::io_uring_context& ioc;
+
+    // held so the file ring stays for as long as the service
+    std::shared_ptr<urpc::file_ring> ring;
+    urpc::file_ring& files;
+    bool direct;
+
+    std::unordered_map<uint64_t, session> sessions;
+    urpc::heartbeat::subscription beat;
+
+    static constexpr uint64_t alignment = 4096;
+    static constexpr uint32_t idle = 60000;
+    static constexpr uint64_t slice = 4 << 20;
 };
 
 int main(int argc, char* argv[])
 {
-    if (argc != 4)
+    if (argc != 4 && (argc != 5 || std::string(argv[4]) != "--direct"))
     {
-        std::cout << "Usage: " << argv[0] << " <host> <port> <path>" << std::endl;
+        std::cout << "Usage: " << argv[0] << " <host> <port> <path> [--direct]" << std::endl;
 
         return 1;
     }
@@ -166,7 +622,7 @@ int main(int argc, char* argv[])
     net::io_uring_context ioc;
     net::inplace_stop_source source;
 
-    service s(path);
+    service s(ioc, path, argc == 5);
     urpc::server server(ioc, host, port);
 
     server.register_service(&s, gp::NewPermanentCallback(&done));
@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <controller.hpp>
+
+namespace urpc
+{
+    struct cache_options
+    {
+        // bytes of requests and responses kept, least recently used entries are evicted first
+        size_t capacity = 16 << 20;
+
+        // milliseconds an entry stays valid
+        uint32_t ttl = 1000;
+    };
+
+    // serialized responses of a pure method, keyed by a hash of the serialized request; the request
+    // bytes are kept alongside so a hash collision is a miss rather than a wrong answer
+    class response_cache
+    {
+    public:
+        using value_t = std::shared_ptr<const std::string>;
+
+        struct entry
+        {
+            uint64_t hash;
+            std::string request;
+
+            value_t response;
+            time_point_t expires;
+        };
+
+        using entries_t = std::list<entry>;
+        using index_t = std::unordered_map<uint64_t, entries_t::iterator>;
+
+        response_cache(const cache_options& options) : options(options)
+        {
+        }
+
+        static uint64_t hash(std::string_view request)
+        {
+            return std::hash<std::string_view>()(request);
+        }
+
+        value_t get(uint64_t hash, std::string_view request)
+        {
+            auto it = index.find(hash);
+
+            if (it == index.end())
+            {
+                ++misses_;
+
+                return {};
+            }
+
+            auto e = it->second;
+
+            if (e->expires <= steady_t::now())
+            {
+                erase(e);
+                ++misses_;
+
+                return {};
+            }
+
+            if (e->request != request)
+            {
+                ++misses_;
+
+                return {};
+            }
+
+            entries.splice(entries.begin(), entries, e);
+            ++hits_;
+
+            return e->response;
+        }
+
+        void put(uint64_t hash, std::string request, std::string response)
+        {
+            size_t n = request.size() + response.size();
+
+            if (n > options.capacity)
+                return;
+
+            if (auto it = index.find(hash); it != index.end())
+                erase(it->second);
+
+            auto expires = steady_t::now() + std::chrono::milliseconds(options.ttl);
+            entries.push_front({ hash, std::move(request), std::make_shared<const std::string>(std::move(response)), expires });
+
+            index.try_emplace(hash, entries.begin());
+            bytes_ += n;
+
+            while (bytes_ > options.capacity)
+                erase(std::prev(entries.end()));
+        }
+
+        void erase(entries_t::iterator e)
+        {
+            bytes_ -= e->request.size() + e->response->size();
+
+            index.erase(e->hash);
+            entries.erase(e);
+        }
+
+        void clear()
+        {
+            index.clear();
+            entries.clear();
+
+            bytes_ = 0;
+        }
+
+        size_t size() const
+        {
+            return entries.size();
+        }
+
+        size_t bytes() const
+        {
+            return bytes_;
+        }
+
+        uint64_t hits() const
+        {
+            return hits_;
+        }
+
+        uint64_t misses() const
+        {
+            return misses_;
+        }
+
+    private:
+        cache_options options;
+
+        entries_t entries;
+        index_t index;
+
+        size_t bytes_ = 0;
+
+        uint64_t hits_ = 0;
+        uint64_t misses_ = 0;
+    };
+}
+
+#endif
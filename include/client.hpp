@@ -10,17 +10,41 @@
 #ifndef CLIENT_HPP
 #define CLIENT_HPP
 
+#include <deque>
+#include <random>
+#include <optional>
+#include <unordered_set>
+#include <tls.hpp>
+#include <hedge.hpp>
 #include <header.hpp>
+#include <keepalive.hpp>
+#include <monitor.hpp>
 
 namespace urpc
 {
+    // one entry of channel::batch, the outcome of each call is reported in status and message
+    struct batch_call
+    {
+        const MethodDescriptor* method = nullptr;
+
+        const Message* request = nullptr;
+        Message* response = nullptr;
+
+        urpc::status status = SUCCEED;
+        std::string message;
+    };
+
     struct call
     {
         call(net::io_uring_context& ioc, uint64_t id) : timer(ioc), id(id)
         {
         }
 
-        const MethodDescriptor* method;
+        const MethodDescriptor* method = nullptr;
+        const std::string* name = nullptr;
+
+        std::vector<batch_call>* batch = nullptr;
+
         urpc::controller* controller;
 
         const Message* request;
@@ -29,12 +53,16 @@ namespace urpc
         Closure* done;
         uint32_t timeout;
 
+        time_point_t start;
+        uint32_t attempts = 0;
+
         header* buff = nullptr;
         net::steady_timer timer;
 
         uint64_t id;
         uint32_t size = 0;
 
+        uint32_t count = 0;
         bool called= false;
 
         ~call()
@@ -54,6 +82,77 @@ namespace urpc
         using task_t = std::shared_ptr<call>;
         using tasks_t = std::unordered_map<uint64_t, task_t>;
 
+        using queue_t = std::deque<task_t>;
+
+        // one call on the wire shared by every caller asking the same thing while it is in flight
+        struct flight : public Closure
+        {
+            struct waiter
+            {
+                urpc::controller* controller;
+
+                Message* response;
+                Closure* done;
+            };
+
+            // the wire call holds the flight until it completes, even after every waiter has left; a retry may
+            // complete it on another connection after this one is gone, the waiters are answered all the same
+            void Run()
+            {
+                auto f = std::move(self);
+
+                if (auto p = owner.lock(); p)
+                    p->on_flight(f);
+                else
+                    f->complete();
+            }
+
+            // the last waiter takes the response, the others get a copy
+            void complete()
+            {
+                auto list = std::move(waiters);
+
+                for (size_t i = 0; i < list.size(); ++i)
+                {
+                     auto& [c, res, done] = list[i];
+                     c->canceller(nullptr);
+
+                     if (controller.Failed())
+                         c->SetFailed(controller.ErrorText(), controller.ErrorCode());
+                     else if (i + 1 < list.size())
+                         res->CopyFrom(*response);
+                     else
+                         res->GetReflection()->Swap(res, response.get());
+
+                     done->Run();
+                }
+            }
+
+            // a waiter must not outlive its own timeout, so only join flights that end no later
+            bool joinable(uint32_t timeout, time_point_t now)
+            {
+                if (!timeout)
+                    return true;
+
+                return controller.timeout() && deadline <= now + std::chrono::milliseconds(timeout);
+            }
+
+            std::weak_ptr<client> owner;
+            std::string key;
+
+            urpc::controller controller;
+            time_point_t deadline;
+
+            std::unique_ptr<Message> request;
+            std::unique_ptr<Message> response;
+
+            std::vector<waiter> waiters;
+            std::shared_ptr<flight> self;
+        };
+
+        using flight_t = std::shared_ptr<flight>;
+        using flights_t = std::unordered_map<std::string, flight_t>;
+
         client(T& channel, net::io_uring_context& ioc, const std::string& endpoint) : channel(channel), ioc(ioc), socket(ioc), endpoint(endpoint)
         {
         }
@@ -75,10 +174,14 @@ namespace urpc
                 return;
 
             auto& c = task->controller; 
+            c->canceller(nullptr);
 
             if (!reason.empty())
                 c->SetFailed(reason, status);
 
+            if (c->Failed() && !c->IsCanceled() && channel.retry(task))
+                return;
+
             try
             {
                 task->done->Run();
@@ -95,25 +198,42 @@ namespace urpc
         {
             auto reason = ec.message();
 
-            socket.shutdown(socket_t::shutdown_both);
+            socket.shutdown();
             socket.close();
 
-            channel.remove(endpoint);
+            channel.remove(endpoint, this);
 
             for (auto& [_, task] : tasks)
             {
                  task->timer.cancel();
-                 execute(task, reason);
+                 execute(task, reason, UNAVAILABLE);
+            }
+
+            for (auto& task : std::exchange(pending, {}))
+            {
+                 task->timer.cancel();
+                 execute(task, reason, UNAVAILABLE);
             }
 
             tasks.clear();
+            queue.clear();
         }
 
-        void CallMethod(const MethodDescriptor* method, controller* controller, const Message* request, Message* response, Closure* done)
+        void CallMethod(const MethodDescriptor* method, controller* controller, const Message* request, Message* response, Closure* done, const std::string* name = nullptr)
+        {
+            if (channel.coalescing(method) && coalesce(method, controller, request, response, done, name))
+                return;
+
+            submit(method, controller, request, response, done, name);
+        }
+
+        void submit(const MethodDescriptor* method, controller* controller, const Message* request, Message* response, Closure* done, const std::string* name)
         {
             auto task = std::make_shared<call>(ioc, ++id);
 
             task->method = method;
+            task->name = name;
+
             task->controller = controller;
 
             task->request = request;
@@ -121,39 +241,195 @@ namespace urpc
 
             task->done = done;
 
-            if (socket.is_open())
-                do_write(task);
-            else
+            task->start = steady_t::now();
+            task->timeout = controller->timeout();
+
+            start(task);
+        }
+
+        bool coalesce(const MethodDescriptor* method, controller* c, const Message* request, Message* response, Closure* done, const std::string* name)
+        {
+            std::string key = method->full_name();
+            key.push_back('\0');
+
+            if (!request->AppendToString(&key))
+                return false;
+
+            auto now = steady_t::now();
+            auto it = flights.find(key);
+
+            if (it != flights.end())
             {
-                do_connect(task);
-                connecting = true;
+                if (!it->second->joinable(c->timeout(), now))
+                    return false;
+
+                join(it->second, c, response, done);
+
+                return true;
+            }
+
+            auto f = std::make_shared<flight>();
+
+            f->owner = this->weak_from_this();
+            f->key = key;
+
+            auto& controller = f->controller;
+
+            controller.host(c->host());
+            controller.port(c->port());
+
+            controller.timeout(c->timeout());
+            f->deadline = now + std::chrono::milliseconds(c->timeout());
+
+            f->request.reset(request->New());
+            f->request->CopyFrom(*request);
+
+            f->response.reset(response->New());
+
+            f->self = f;
+
+            flights.try_emplace(std::move(key), f);
+            join(f, c, response, done);
+
+            submit(method, &controller, f->request.get(), f->response.get(), f.get(), name);
+
+            return true;
+        }
+
+        void join(flight_t& f, controller* c, Message* response, Closure* done)
+        {
+            f->waiters.push_back({ c, response, done });
+
+            c->canceller([f, c, self = this->weak_from_this()]
+            {
+                if (auto p = self.lock(); p)
+                    p->leave(f, c);
+            });
+        }
+
+        void leave(flight_t f, controller* c)
+        {
+            auto& waiters = f->waiters;
+            auto it = std::find_if(waiters.begin(), waiters.end(), [c](auto& w){ return w.controller == c; });
+
+            if (it == waiters.end())
+                return;
+
+            auto done = it->done;
+            waiters.erase(it);
+
+            c->SetFailed("Call cancelled", CANCELED);
+            done->Run();
+
+            if (waiters.empty())
+            {
+                if (auto it = flights.find(f->key); it != flights.end() && it->second == f)
+                    flights.erase(it);
+
+                f->controller.StartCancel();
+            }
+        }
+
+        void on_flight(flight_t& f)
+        {
+            auto it = flights.find(f->key);
+
+            if (it != flights.end() && it->second == f)
+                flights.erase(it);
+
+            f->complete();
+        }
+
+        void batch(controller* controller, std::vector<batch_call>* calls, Closure* done)
+        {
+            auto task = std::make_shared<call>(ioc, ++id);
+
+            task->batch = calls;
+            task->controller = controller;
+
+            task->done = done;
+
+            task->start = steady_t::now();
+            task->timeout = controller->timeout();
+
+            start(task);
+        }
+
+        void resend(task_t task)
+        {
+            task->id = ++id;
+            task->timeout = remaining(task);
+
+            start(task);
+        }
 
-                reset_timer(task);
+        void start(task_t& task)
+        {
+            used = steady_t::now();
+
+            task->controller->canceller([task, self = this->weak_from_this()]
+            {
+                if (auto p = self.lock(); p)
+                    p->cancel(task);
+            });
+
+            if (socket.is_open() && !connecting)
+                return do_write(task);
+
+            pending.push_back(task);
+            reset_timer(task);
+
+            if (!connecting)
+            {
+                connecting = true;
+                do_connect(task);
             }
         }
 
         void reset_timer(task_t task)
         {
-            if (auto n = task->controller->timeout(); n)
+            if (auto n = task->timeout; n)
             {
                 task->timer.expires_from_now(std::chrono::milliseconds(n));
 
-                task->timer.async_wait([task, self = shared_this()](error_code_t ec)
+                task->timer.async_wait(channel.monitor().wrap("client::on_timeout",
+                [task, self = shared_this()](error_code_t ec)
                 {
                     self->on_timeout(task, ec);
-                });
+                }));
             }
         }
 
+        void cancel(task_t task)
+        {
+            if (task->called)
+                return;
+
+            task->timer.cancel();
+            std::erase(pending, task);
+
+            if (tasks.erase(task->id) && !connecting)
+                do_cancel(task->id);
+
+            execute(task, std::string("Call cancelled"), CANCELED);
+            release();
+        }
+
         void on_timeout(task_t task, error_code_t ec)
         {
             if (!ec)
             {
-                tasks.erase(task->id);
+                std::erase(pending, task);
+
+                if (tasks.erase(task->id) && !connecting)
+                    do_cancel(task->id);
+
                 execute(task, std::string("Connection timed out"), TIMEDOUT);
 
                 if (connecting)
                     close(std::make_error_code(std::errc::timed_out));
+                else
+                    release();
             }
             else if (ec == std::errc::operation_canceled)
             {
@@ -164,25 +440,58 @@ namespace urpc
         {
             auto& c = task->controller;
 
-            net::async_connect(socket, tcp::endpoint(net::ip::make_address(c->host()), std::stoi(c->port())),
+            socket.async_connect(c->host(), c->port(),
+            channel.monitor().wrap("client::on_connect",
             [task, self = shared_this()](error_code_t ec, int fd)
             {
                 self->on_connect(task, ec);
-            });
+            }));
         }
 
         void on_connect(task_t task, error_code_t ec)
         {
             if (!ec)
+                socket.apply(channel.transport());
+
+            if (auto& tls = channel.tls(); !ec && tls && !socket.is_local())
             {
-                connecting = false;
+                return std::make_shared<tls_handshake>(ioc, *tls, socket,
+                channel.monitor().wrap("client::on_handshake",
+                [self = shared_this()](error_code_t ec)
+                {
+                    self->on_handshake(ec);
+                }))->run();
+            }
+
+            on_handshake(ec);
+        }
+
+        void on_handshake(error_code_t ec)
+        {
+            connecting = false;
+
+            if (!ec)
+            {
+                heard = steady_t::now();
+
+                // the calls before the PONG go without trailers, the ones after it carry them
+                if (channel.checksum())
+                    do_ping();
 
-                do_write(task);
+                for (auto& t : pending)
+                     do_write(t);
+
+                pending.clear();
                 do_read_header();
             }
             else
             {
-                execute(task, std::string("async_connect: ") + ec.message());
+                for (auto& t : std::exchange(pending, {}))
+                {
+                     t->timer.cancel();
+                     execute(t, std::string("async_connect: ") + ec.message(), UNAVAILABLE);
+                }
+
                 close(ec);
             }
         }
@@ -192,18 +501,31 @@ namespace urpc
             if (!allocate(buff, size, sizeof(header)))
                 return close(std::make_error_code(std::errc::not_enough_memory));
 
-            net::async_read(socket, net::buffer(buff, sizeof(header)),
+            socket.async_read(buff, sizeof(header),
+            channel.monitor().wrap("client::on_read_header",
             [self = shared_this()](error_code_t ec, std::size_t bytes_transferred)
             {
                 self->on_read_header(ec, bytes_transferred);
-            });
+            }));
         }
 
         void on_read_header(error_code_t ec, std::size_t bytes_transferred)
         {
             if (!ec)
             {
-                count = buff->rpc_len + buff->arg_len;
+                heard = steady_t::now();
+                pinged = {};
+
+                if (buff->flags & VERIFIES)
+                    verifies = true;
+
+                if (buff->type == PONG)
+                    return do_read_header();
+
+                if (buff->type == GOAWAY)
+                    return on_goaway();
+
+                count = buff->rpc_len + buff->arg_len + trailer(buff->flags);
 
                 if (!allocate(buff, size, count + sizeof(header)))
                     return close(std::make_error_code(std::errc::not_enough_memory));
@@ -214,19 +536,43 @@ namespace urpc
                 close(ec);
         }
 
+        // the server is draining, new calls go to a fresh connection and this one closes once it is idle
+        void on_goaway()
+        {
+            going = true;
+            channel.remove(endpoint, this);
+
+            if (!release())
+                do_read_header();
+        }
+
+        bool release()
+        {
+            if (!going || !socket.is_open() || !tasks.empty() || !pending.empty())
+                return false;
+
+            close(std::make_error_code(std::errc::connection_aborted));
+
+            return true;
+        }
+
         void do_read_message()
         {
-            net::async_read(socket, net::buffer(buff->data, count),
+            socket.async_read(buff->data, count,
+            channel.monitor().wrap("client::on_read_message",
             [self = shared_this()](error_code_t ec, std::size_t bytes_transferred)
             {
                 self->on_read_message(ec, bytes_transferred);
-            });
+            }));
         }
 
         void on_read_message(error_code_t ec, std::size_t bytes_transferred)
         {
             if (!ec)
             {
+                if (buff->flags & CHECKSUM && !verify(buff))
+                    return close(std::make_error_code(std::errc::illegal_byte_sequence));
+
                 response rep;
                 copy<0>(buff, rep, rep.message);
 
@@ -240,28 +586,108 @@ namespace urpc
                 if (rep.status != SUCCEED)
                     task->controller->SetFailed(rep.message, rep.status);
 
-                if (!task->response->ParseFromArray(buff->data + buff->rpc_len, buff->arg_len))
+                if (task->batch)
+                {
+                    if (!on_batch(task, rep))
+                        task->controller->SetFailed("Cannot ParseFromArray", ERROR);
+                }
+                else if (!task->response->ParseFromArray(buff->data + buff->rpc_len, buff->arg_len))
                     task->controller->SetFailed("Cannot ParseFromArray", ERROR);
 
-                do_read_header();
-
                 tasks.erase(it);
+
+                if (!release())
+                    do_read_header();
+
                 set_done(task);
             }
             else
                 close(ec);
         }
 
+        bool on_batch(task_t& task, response& rep)
+        {
+            auto& calls = *task->batch;
+
+            if (buff->type != BATCH)
+            {
+                for (auto& c : calls)
+                {
+                     c.status = rep.status;
+                     c.message = rep.message;
+                }
+
+                return true;
+            }
+
+            const char* p = buff->data + buff->rpc_len;
+            const char* end = p + buff->arg_len;
+
+            for (auto& c : calls)
+            {
+                 uint32_t status;
+                 uint32_t len;
+
+                 if (!take(p, end, &status, sizeof(status)) || !take(p, end, &len, sizeof(len)) || size_t(end - p) < len)
+                     return false;
+
+                 c.status = urpc::status(status);
+                 c.message.assign(p, len);
+
+                 p += len;
+
+                 if (!take(p, end, &len, sizeof(len)) || size_t(end - p) < len)
+                     return false;
+
+                 if (len && !c.response->ParseFromArray(p, len))
+                 {
+                     c.status = ERROR;
+                     c.message = "Cannot ParseFromArray";
+                 }
+
+                 p += len;
+            }
+
+            return true;
+        }
+
+        uint32_t remaining(task_t& task)
+        {
+            if (auto n = task->controller->timeout(); n)
+            {
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(steady_t::now() - task->start).count();
+
+                return elapsed < n ? n - elapsed : 1;
+            }
+
+            return 0;
+        }
+
         void do_write(task_t task)
         {
-            std::string name = task->method->service()->name() + "." + task->method->name();
+            if (task->called)
+                return;
+
+            if (task->count)
+                return do_rewrite(task);
+
+            if (task->batch)
+                return do_write_batch(task);
 
-            uint32_t rpc_len = sizeof(task->id) + sizeof(size_t) + name.size();
+            request req { task->id, remaining(task) };
+            task->timeout = req.timeout;
+
+            if (!task->name)
+                req.name = task->method->service()->name() + "." + task->method->name();
+
+            auto& name = task->name ? *task->name : req.name;
+            uint32_t rpc_len = sizeof(req.id) + sizeof(req.timeout) + sizeof(size_t) + name.size();
             uint32_t arg_len = task->request->ByteSizeLong();
 
-            count = sizeof(urpc::header) + rpc_len + arg_len;
+            uint16_t flags = channel.checksum() ? CHECKSUM : 0;
+            task->count = sizeof(urpc::header) + rpc_len + arg_len + trailer(flags);
 
-            if (!allocate(task->buff, task->size, count))
+            if (!allocate(task->buff, task->size, task->count))
             {
                 task->controller->SetFailed("Cannot allocate memory", OOM);
 
@@ -271,7 +697,10 @@ namespace urpc
             task->buff->rpc_len = rpc_len;
             task->buff->arg_len = arg_len;
 
-            copy<1>(task->buff, task->id, name);
+            task->buff->type = CALL;
+            task->buff->flags = flags;
+
+            copy<1>(task->buff, req, name);
 
             if (!task->request->SerializeToArray(task->buff->data + rpc_len, arg_len))
             {
@@ -280,23 +709,211 @@ namespace urpc
                 return set_done(task);
             }
 
+            do_send(task);
+        }
+
+        // a batch is a call frame without a name, its payload packs the name and request of every entry
+        void do_write_batch(task_t task)
+        {
+            request req { task->id, remaining(task) };
+            task->timeout = req.timeout;
+
+            auto& calls = *task->batch;
+
+            std::vector<std::string> names;
+            std::vector<uint32_t> sizes;
+
+            names.reserve(calls.size());
+            sizes.reserve(calls.size());
+
+            uint32_t rpc_len = sizeof(req.id) + sizeof(req.timeout) + sizeof(size_t);
+            size_t arg_len = sizeof(uint32_t);
+
+            for (auto& c : calls)
+            {
+                 names.push_back(c.method->service()->name() + "." + c.method->name());
+                 sizes.push_back(c.request->ByteSizeLong());
+
+                 arg_len += 2 * sizeof(uint32_t) + names.back().size() + sizes.back();
+            }
+
+            uint16_t flags = channel.checksum() ? CHECKSUM : 0;
+            task->count = sizeof(urpc::header) + rpc_len + arg_len + trailer(flags);
+
+            if (!allocate(task->buff, task->size, task->count))
+            {
+                task->controller->SetFailed("Cannot allocate memory", OOM);
+
+                return set_done(task);
+            }
+
+            task->buff->rpc_len = rpc_len;
+            task->buff->arg_len = arg_len;
+
+            task->buff->type = BATCH;
+            task->buff->flags = flags;
+
+            copy<1>(task->buff, req, req.name);
+
+            char* p = task->buff->data + rpc_len;
+            uint32_t n = calls.size();
+
+            p = put(p, &n, sizeof(n));
+
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                 uint32_t len = names[i].size();
+
+                 p = put(p, &len, sizeof(len));
+                 p = put(p, names[i].data(), len);
+
+                 p = put(p, &sizes[i], sizeof(uint32_t));
+
+                 if (!calls[i].request->SerializeToArray(p, sizes[i]))
+                 {
+                     task->controller->SetFailed("Cannot SerializeToArray", ERROR);
+
+                     return set_done(task);
+                 }
+
+                 p += sizes[i];
+            }
+
+            do_send(task);
+        }
+
+        // a retried call reuses its serialized frame, only the id and the remaining time change
+        void do_rewrite(task_t task)
+        {
+            task->timeout = remaining(task);
+
+            std::memcpy(task->buff->data, &task->id, sizeof(task->id));
+            std::memcpy(task->buff->data + sizeof(task->id), &task->timeout, sizeof(task->timeout));
+
+            do_send(task);
+        }
+
+        // sealed here, after do_rewrite has patched the frame; the trailer room stays unused
+        // until the server has flagged a frame VERIFIES
+        void do_send(task_t task)
+        {
+            if (task->buff->flags & CHECKSUM && !verifies)
+            {
+                task->buff->flags &= ~CHECKSUM;
+                task->count -= trailer(CHECKSUM);
+            }
+
+            if (task->buff->flags & CHECKSUM)
+                seal(task->buff);
+
             tasks.try_emplace(task->id, task);
             reset_timer(task);
 
-            net::async_write(socket, net::buffer(task->buff, count),
+            enqueue(task);
+        }
+
+        void do_cancel(uint64_t id)
+        {
+            auto task = std::make_shared<call>(ioc, id);
+
+            task->called = true;
+            task->count = sizeof(urpc::header) + sizeof(id);
+
+            if (!allocate(task->buff, task->size, task->count))
+                return;
+
+            task->buff->rpc_len = sizeof(id);
+            task->buff->arg_len = 0;
+
+            task->buff->type = CANCEL;
+            task->buff->flags = 0;
+
+            std::memcpy(task->buff->data, &id, sizeof(id));
+
+            enqueue(task);
+        }
+
+        void do_ping()
+        {
+            auto task = std::make_shared<call>(ioc, 0);
+
+            task->called = true;
+            task->count = sizeof(urpc::header);
+
+            if (!allocate(task->buff, task->size, task->count))
+                return;
+
+            task->buff->rpc_len = 0;
+            task->buff->arg_len = 0;
+
+            task->buff->type = PING;
+            task->buff->flags = 0;
+
+            enqueue(task);
+        }
+
+        // a silent connection is pinged and declared dead if it stays silent, so its calls fail over
+        // now instead of waiting out their timeouts; one unused for options.idle is let go
+        void probe(time_point_t now, const keepalive_options& options)
+        {
+            if (connecting || !socket.is_open())
+                return;
+
+            if (pinged != time_point_t())
+            {
+                if (now - pinged >= std::chrono::milliseconds(options.timeout))
+                    close(std::make_error_code(std::errc::timed_out));
+
+                return;
+            }
+
+            if (options.idle && tasks.empty() && pending.empty() && now - used >= std::chrono::milliseconds(options.idle))
+                return close(std::make_error_code(std::errc::connection_aborted));
+
+            if (options.ping && now - heard >= std::chrono::milliseconds(options.ping))
+            {
+                pinged = now;
+                do_ping();
+            }
+        }
+
+        void enqueue(task_t task)
+        {
+            queue.push_back(task);
+
+            if (queue.size() == 1)
+                do_flush();
+        }
+
+        void do_flush()
+        {
+            auto task = queue.front();
+
+            socket.async_write(task->buff, task->count,
+            channel.monitor().wrap("client::on_write",
             [task, self = shared_this()](error_code_t ec, std::size_t bytes_transferred)
             {
                 self->on_write(task, ec, bytes_transferred);
-            });
+            }));
         }
 
         void on_write(task_t task, error_code_t ec, std::size_t bytes_transferred)
         {
             if (ec)
             {
-                execute(task, std::string("async_write: ") + ec.message());
-                close(ec);
+                tasks.erase(task->id);
+                execute(task, std::string("async_write: ") + ec.message(), UNAVAILABLE);
+
+                return close(ec);
             }
+
+            if (queue.empty())
+                return;
+
+            queue.pop_front();
+
+            if (!queue.empty())
+                do_flush();
         }
 
         ~client()
@@ -315,14 +932,28 @@ namespace urpc
         uint64_t id = 0;
         tasks_t tasks;
 
-        socket_t socket;
+        queue_t queue;
+        queue_t pending;
+
+        stream socket;
         std::string endpoint;
 
+        flights_t flights;
+
+        time_point_t used;
+        time_point_t heard;
+
+        time_point_t pinged;
+
         uint32_t size = 0;
         uint32_t count = 0;
 
         header* buff = nullptr;
+
         bool connecting = false;
+        bool going = false;
+
+        bool verifies = false;
     };
 
     class channel : public RpcChannel
@@ -333,42 +964,256 @@ namespace urpc
         using connection_t = std::shared_ptr<client_t>;
         using connections_t = std::unordered_map<std::string, connection_t>;
 
-        channel(net::io_uring_context& ioc) : ioc(ioc)
+        using hedges_t = std::unordered_map<std::string, hedging>;
+        using retries_t = std::unordered_map<std::string, retrying>;
+
+        channel(net::io_uring_context& ioc) : ioc(ioc), monitor_(loop_monitor::of(ioc))
         {
         }
 
         void CallMethod(const MethodDescriptor* method, RpcController* Controller, const Message* request, Message* response, Closure* done)
+        {
+            call(method, nullptr, Controller, request, response, done);
+        }
+
+        // entry of the generated stubs, name is the precomputed wire name of the method
+        void call(const MethodDescriptor* method, const std::string* name, RpcController* Controller, const Message* request, Message* response, Closure* done)
+        {
+            auto c = static_cast<controller*>(Controller);
+
+            if (!retries.empty())
+            {
+                if (auto it = retries.find(method->full_name()); it != retries.end())
+                    it->second.budget.deposit();
+            }
+
+            if (!hedges.empty() && !c->backups().empty())
+            {
+                if (auto it = hedges.find(method->full_name()); it != hedges.end())
+                    return std::make_shared<urpc::hedge<channel>>(*this, ioc, it->second, method, name, c, request, response, done)->run();
+            }
+
+            dispatch(method, name, c, request, response, done);
+        }
+
+        void dispatch(const MethodDescriptor* method, const std::string* name, controller* c, const Message* request, Message* response, Closure* done)
+        {
+            connection(c)->CallMethod(method, c, request, response, done, name);
+        }
+
+        // calls to the endpoint of the controller travel in one frame and come back in one reply,
+        // the controller reports transport level failures and each entry its own outcome
+        void batch(RpcController* Controller, std::vector<batch_call>& calls, Closure* done)
         {
             auto c = static_cast<controller*>(Controller);
+            connection(c)->batch(c, &calls, done);
+        }
 
+        connection_t connection(controller* c)
+        {
             auto endpoint = c->host() + ":" + c->port();
             auto it = connections.find(endpoint);
 
-            connection_t conn;
+            if (it != connections.end())
+                return it->second;
+
+            auto conn = std::make_shared<client_t>(*this, ioc, endpoint);
+            connections.try_emplace(endpoint, conn);
+
+            return conn;
+        }
+
+        void tls(const tls_options& options)
+        {
+            tls_.emplace(options, false);
+        }
+
+        std::optional<tls_context>& tls()
+        {
+            return tls_;
+        }
+
+        void transport(const transport_options& options)
+        {
+            transport_ = options;
+        }
+
+        const transport_options& transport() const
+        {
+            return transport_;
+        }
+
+        // calls carry a CRC32C trailer and servers answer in kind, once a server has announced it verifies them
+        void checksum(bool on)
+        {
+            checksum_ = on;
+        }
+
+        bool checksum() const
+        {
+            return checksum_;
+        }
+
+        void hedge(const std::string& method, const hedge_policy& policy)
+        {
+            hedges.insert_or_assign(method, hedging(policy));
+        }
+
+        void retry(const std::string& method, const retry_policy& policy)
+        {
+            retries.insert_or_assign(method, retrying(policy));
+        }
+
+        void keepalive(const keepalive_options& options)
+        {
+            keepalive_ = options;
+
+            beat.reset();
+            beat.emplace(ioc, options.interval, [this](time_point_t now){ sweep(now); });
+        }
+
+        void sweep(time_point_t now)
+        {
+            std::vector<connection_t> conns;
+            conns.reserve(connections.size());
+
+            for (auto& [_, conn] : connections)
+                 conns.push_back(conn);
+
+            for (auto& conn : conns)
+                 conn->probe(now, keepalive_);
+        }
+
+        // identical calls of a method in flight on one connection share a single request and response
+        void coalesce(const std::string& method)
+        {
+            singleflight.insert(method);
+        }
+
+        bool coalescing(const MethodDescriptor* method) const
+        {
+            return !singleflight.empty() && singleflight.contains(method->full_name());
+        }
+
+        bool retry(std::shared_ptr<urpc::call>& task)
+        {
+            if (retries.empty() || !task->method)
+                return false;
+
+            auto it = retries.find(task->method->full_name());
+
+            if (it == retries.end())
+                return false;
 
-            if (it == connections.end())
+            auto& [policy, budget] = it->second;
+            auto c = task->controller;
+
+            if (task->attempts + 1 >= policy.attempts || !policy.retryable(c->ErrorCode()))
+                return false;
+
+            uint32_t backoff = std::min<uint64_t>(uint64_t(policy.backoff) << task->attempts, policy.max_backoff);
+            backoff = backoff / 2 + std::uniform_int_distribution<uint32_t>(0, backoff - backoff / 2)(generator);
+
+            if (auto n = c->timeout(); n && elapsed(task) + backoff >= n)
+                return false;
+
+            if (!budget.withdraw())
+                return false;
+
+            ++task->attempts;
+            c->recover();
+
+            c->canceller([task]{ task->timer.cancel(); });
+            task->timer.expires_from_now(std::chrono::milliseconds(backoff));
+
+            backoffs.insert(task);
+
+            task->timer.async_wait(monitor_->wrap("channel::on_backoff",
+            [self = std::weak_ptr(anchor), task](error_code_t ec)
             {
-                conn = std::make_shared<client_t>(*this, ioc, endpoint);
-                connections.try_emplace(endpoint, conn);
-            }
-            else
-                conn = it->second;
+                if (auto p = self.lock(); p)
+                    (*p)->on_backoff(task, ec);
+            }));
 
-            conn->CallMethod(method, c, request, response, done);
+            return true;
         }
 
-        void remove(const std::string& endpoint) 
+        void on_backoff(std::shared_ptr<urpc::call> task, error_code_t ec)
         {
-            connections.erase(endpoint);
+            auto c = task->controller;
+            backoffs.erase(task);
+
+            // the timer may fire late, a call with no time left would otherwise go out once more with 1 ms
+            if (auto n = c->timeout(); !ec && !c->IsCanceled() && n && elapsed(task) >= n)
+                return abandon(task, "Connection timed out", TIMEDOUT);
+
+            if (!ec && !c->IsCanceled())
+                return connection(c)->resend(task);
+
+            abandon(task);
         }
 
+        uint64_t elapsed(const std::shared_ptr<urpc::call>& task) const
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(steady_t::now() - task->start).count();
+        }
+
+        void abandon(const std::shared_ptr<urpc::call>& task, const std::string& text = "Call cancelled", status status = CANCELED)
+        {
+            auto c = task->controller;
+            c->canceller(nullptr);
+            c->SetFailed(text, status);
+
+            task->called = true;
+            task->done->Run();
+        }
+
+        void remove(const std::string& endpoint, client_t* conn)
+        {
+            if (auto it = connections.find(endpoint); it != connections.end() && it->second.get() == conn)
+                connections.erase(it);
+        }
+
+        loop_monitor& monitor()
+        {
+            return *monitor_;
+        }
+
+        // calls waiting out a backoff fail as cancelled, their timers fire after the channel is gone
         ~channel()
         {
+            anchor.reset();
+
+            for (auto& task : std::exchange(backoffs, {}))
+            {
+                 task->timer.cancel();
+                 abandon(task);
+            }
         }
 
     private:
         net::io_uring_context& ioc;
+        std::shared_ptr<loop_monitor> monitor_;
+
+        // the backoff timers live in their calls and reach the channel through this while it exists
+        std::shared_ptr<channel*> anchor = std::make_shared<channel*>(this);
+        std::unordered_set<std::shared_ptr<urpc::call>> backoffs;
+
         connections_t connections;
+
+        hedges_t hedges;
+        retries_t retries;
+
+        std::unordered_set<std::string> singleflight;
+
+        std::default_random_engine generator;
+        std::optional<tls_context> tls_;
+        transport_options transport_;
+
+        bool checksum_ = false;
+
+        keepalive_options keepalive_;
+        std::optional<heartbeat::subscription> beat;
     };
 }
 
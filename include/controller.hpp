@@ -10,6 +10,8 @@
 #ifndef CONTROLLER_HPP
 #define CONTROLLER_HPP
 
+#include <vector>
+#include <functional>
 #include <unp.hpp>
 #include <google/protobuf/message.h>
 #include <google/protobuf/service.h>
@@ -19,6 +21,9 @@ namespace urpc
     namespace net = unp;
     namespace gp = google::protobuf;
 
+    using steady_t = net::monotonic_clock;
+    using time_point_t = typename steady_t::time_point;
+
     using tcp = net::ip::tcp;
     using socket_t = tcp::socket;
 
@@ -34,6 +39,8 @@ namespace urpc
     using RpcController = gp::RpcController;
     using MethodDescriptor = gp::MethodDescriptor;
 
+    using ServiceDescriptor = gp::ServiceDescriptor;
+
     enum status
     {
         OOM,
@@ -41,7 +48,10 @@ namespace urpc
         FAILED,
         SUCCEED,
         UNFOUND,
-        TIMEDOUT
+        TIMEDOUT,
+        CANCELED,
+        OVERLOADED,
+        UNAVAILABLE
     };
 
     class controller : public RpcController
@@ -56,6 +66,20 @@ namespace urpc
             failed = false;
             cancelled = false;
 
+            deadline_ = {};
+            callback_ = nullptr;
+
+            canceller_ = nullptr;
+
+            error_text.clear();
+            error_code = SUCCEED;
+        }
+
+        // forgets the failure of an attempt, a retried call keeps its deadline and cancel notification
+        void recover()
+        {
+            failed = false;
+
             error_text.clear();
             error_code = SUCCEED;
         }
@@ -72,7 +96,15 @@ namespace urpc
 
         virtual void StartCancel()
         {
+            if (cancelled)
+                return;
+
             cancelled = true;
+
+            if (auto canceller = std::move(canceller_); canceller)
+                canceller();
+
+            finish();
         }
 
         virtual void SetFailed(const std::string& reason)
@@ -96,7 +128,21 @@ namespace urpc
 
         virtual void NotifyOnCancel(Closure* callback)
         {
-            callback_ = callback;
+            if (cancelled)
+                callback->Run();
+            else
+                callback_ = callback;
+        }
+
+        void finish()
+        {
+            if (auto callback = std::exchange(callback_, nullptr); callback)
+                callback->Run();
+        }
+
+        void canceller(std::function<void()> canceller)
+        {
+            canceller_ = std::move(canceller);
         }
 
         void host(const std::string& host)
@@ -114,11 +160,52 @@ namespace urpc
             timeout_ = timeout;
         }
 
+        void backup(const std::string& host, const std::string& port)
+        {
+            backups_.emplace_back(host, port);
+        }
+
         void ErrorCode(status status)
         {
             error_code = status;
         }
 
+        void deadline(time_point_t deadline)
+        {
+            deadline_ = deadline;
+        }
+
+        time_point_t deadline() const
+        {
+            return deadline_;
+        }
+
+        // the ring a server or loopback runs the call on, handlers submit their own io there; null on the client side
+        void ring(net::io_uring_context* ring)
+        {
+            ring_ = ring;
+        }
+
+        net::io_uring_context* ring() const
+        {
+            return ring_;
+        }
+
+        bool expired() const
+        {
+            return deadline_ != time_point_t() && steady_t::now() >= deadline_;
+        }
+
+        uint32_t remaining() const
+        {
+            if (deadline_ == time_point_t())
+                return timeout_;
+
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline_ - steady_t::now()).count();
+
+            return left > 0 ? left : 0;
+        }
+
         Closure* callback() const
         {
             return callback_;
@@ -139,6 +226,11 @@ namespace urpc
             return timeout_;
         }
 
+        std::vector<std::pair<std::string, std::string>>& backups()
+        {
+            return backups_;
+        }
+
         status ErrorCode() const
         {
             return error_code;
@@ -155,8 +247,16 @@ namespace urpc
         std::string host_;
         std::string port_;
 
+        std::vector<std::pair<std::string, std::string>> backups_;
+
         uint32_t timeout_;
-        Closure* callback_;
+        time_point_t deadline_;
+
+        net::io_uring_context* ring_ = nullptr;
+
+        Closure* callback_ = nullptr;
+
+        std::function<void()> canceller_;
 
         std::string error_text;
         status error_code = SUCCEED;
@@ -0,0 +1,225 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef CORO_HPP
+#define CORO_HPP
+
+#include <atomic>
+#include <string>
+#include <iostream>
+#include <exception>
+#include <coroutine>
+#include <type_traits>
+#include <controller.hpp>
+
+namespace urpc
+{
+    // an eagerly started, detached coroutine, for client call chains and server handlers alike
+    struct task
+    {
+        struct promise_type
+        {
+            promise_type() = default;
+
+            // a handler coroutine taking (RpcController*, const Request*, Response*, Closure*) reports its failures there
+            template <typename... Args>
+            promise_type(Args&... args)
+            {
+                (bind(args), ...);
+            }
+
+            template <typename T>
+            void bind(T& arg)
+            {
+                if constexpr (std::is_convertible_v<T, RpcController*>)
+                {
+                    if (!controller)
+                        controller = arg;
+                }
+                else if constexpr (std::is_convertible_v<T, Closure*>)
+                {
+                    if (!done)
+                        done = arg;
+                }
+            }
+
+            task get_return_object()
+            {
+                return {};
+            }
+
+            std::suspend_never initial_suspend() noexcept
+            {
+                return {};
+            }
+
+            std::suspend_never final_suspend() noexcept
+            {
+                return {};
+            }
+
+            void return_void()
+            {
+            }
+
+            // never rethrown, after a suspension that would unwind into the event loop and leak the frame
+            void unhandled_exception()
+            {
+                error = std::current_exception();
+
+                std::string what = "unknown exception";
+
+                try
+                {
+                    std::rethrow_exception(error);
+                }
+                catch(std::exception& e)
+                {
+                    what = e.what();
+                }
+                catch(...)
+                {
+                }
+
+                if (controller && done)
+                {
+                    controller->SetFailed(std::string("Server Internal Error ") + what);
+                    done->Run();
+                }
+                else
+                {
+                    std::cerr << "urpc::task: unhandled exception in a detached coroutine: " << what << std::endl;
+                    std::terminate();
+                }
+            }
+
+            RpcController* controller = nullptr;
+            Closure* done = nullptr;
+
+            std::exception_ptr error;
+        };
+    };
+
+    // the awaiter itself is the done closure, so a call allocates nothing beyond the coroutine frame
+    class suspension : public Closure
+    {
+    public:
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        // done may run inline, before the coroutine has suspended, or later on the ring
+        void Run()
+        {
+            if (state.exchange(DONE) == SUSPENDED)
+                handle.resume();
+        }
+
+        bool suspend(std::coroutine_handle<> h)
+        {
+            handle = h;
+
+            return state.exchange(SUSPENDED) != DONE;
+        }
+
+    private:
+        enum
+        {
+            RUNNING,
+            SUSPENDED,
+            DONE
+        };
+
+        std::coroutine_handle<> handle;
+        std::atomic<int> state = RUNNING;
+    };
+
+    template <typename S, typename Request, typename Response>
+    class call_awaiter : public suspension
+    {
+    public:
+        using method_t = void (S::*)(RpcController*, const Request*, Response*, Closure*);
+
+        call_awaiter(S& stub, method_t method, controller& c, const Request& request, Response& response) :
+        stub(stub), method(method), c(c), request(request), response(response)
+        {
+        }
+
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            (stub.*method)(&c, &request, &response, this);
+
+            return suspend(h);
+        }
+
+        bool await_resume() const
+        {
+            return !c.Failed();
+        }
+
+    private:
+        S& stub;
+        method_t method;
+
+        controller& c;
+
+        const Request& request;
+        Response& response;
+    };
+
+    // co_await urpc::async_call(stub, &Stub::method, controller, request, response) yields true on success
+    template <typename S, typename T, typename Request, typename Response>
+    constexpr decltype(auto) async_call(S& stub, void (T::*method)(RpcController*, const Request*, Response*, Closure*), controller& c, const Request& request, Response& response)
+    {
+        return call_awaiter<T, Request, Response>(stub, method, c, request, response);
+    }
+
+    class timer_awaiter
+    {
+    public:
+        timer_awaiter(net::steady_timer& timer) : timer(timer)
+        {
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            timer.async_wait([this, h](error_code_t ec)
+            {
+                this->ec = ec;
+                h.resume();
+            });
+        }
+
+        error_code_t await_resume() const
+        {
+            return ec;
+        }
+
+    private:
+        net::steady_timer& timer;
+        error_code_t ec;
+    };
+
+    // co_await urpc::sleep(timer, period) suspends a handler on the ring without blocking it
+    template <typename D>
+    constexpr decltype(auto) sleep(net::steady_timer& timer, D period)
+    {
+        timer.expires_from_now(period);
+
+        return timer_awaiter(timer);
+    }
+}
+
+#endif
@@ -0,0 +1,186 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace urpc
+{
+    // CRC32C (Castagnoli), the polynomial SSE4.2 implements, reflected
+    class crc32c_engine
+    {
+    public:
+        static constexpr uint32_t polynomial = 0x82f63b78;
+
+        // bytes per lane of the interleaved loop, three lanes hide the 3 cycle latency of the crc32 instruction
+        static constexpr size_t lane = 4096;
+
+        using table_t = std::array<std::array<uint32_t, 256>, 8>;
+
+        static const crc32c_engine& get()
+        {
+            static const crc32c_engine engine;
+
+            return engine;
+        }
+
+        // operates on the raw register, without the initial and final inversion
+        uint32_t update(uint32_t crc, const void* data, size_t n) const
+        {
+#if defined(__x86_64__)
+            if (hardware)
+                return update_sse42(crc, static_cast<const unsigned char*>(data), n);
+#endif
+            return update_table(crc, static_cast<const unsigned char*>(data), n);
+        }
+
+    private:
+        crc32c_engine()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                 uint32_t crc = i;
+
+                 for (int k = 0; k < 8; ++k)
+                      crc = crc & 1 ? crc >> 1 ^ polynomial : crc >> 1;
+
+                 tables[0][i] = crc;
+            }
+
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                 for (size_t t = 1; t < 8; ++t)
+                      tables[t][i] = tables[t - 1][i] >> 8 ^ tables[0][tables[t - 1][i] & 0xff];
+            }
+
+            // advancing the register over zero bytes is linear, so a shift by one lane is fixed by the images of its 32 bits
+            uint32_t basis[32];
+
+            for (int j = 0; j < 32; ++j)
+            {
+                 uint32_t crc = uint32_t(1) << j;
+
+                 for (size_t k = 0; k < lane; ++k)
+                      crc = crc >> 8 ^ tables[0][crc & 0xff];
+
+                 basis[j] = crc;
+            }
+
+            for (int b = 0; b < 4; ++b)
+            {
+                 for (uint32_t v = 0; v < 256; ++v)
+                 {
+                      uint32_t crc = 0;
+
+                      for (int j = 0; j < 8; ++j)
+                      {
+                           if (v >> j & 1)
+                               crc ^= basis[8 * b + j];
+                      }
+
+                      shifts[b][v] = crc;
+                 }
+            }
+
+#if defined(__x86_64__)
+            hardware = __builtin_cpu_supports("sse4.2");
+#endif
+        }
+
+        uint32_t shift(uint32_t crc) const
+        {
+            return shifts[0][crc & 0xff] ^ shifts[1][crc >> 8 & 0xff] ^ shifts[2][crc >> 16 & 0xff] ^ shifts[3][crc >> 24];
+        }
+
+        // slicing by 8
+        uint32_t update_table(uint32_t crc, const unsigned char* p, size_t n) const
+        {
+            for (; n >= 8; n -= 8, p += 8)
+            {
+                 uint64_t word;
+                 std::memcpy(&word, p, 8);
+
+                 word ^= crc;
+
+                 crc = tables[7][word & 0xff] ^ tables[6][word >> 8 & 0xff] ^ tables[5][word >> 16 & 0xff] ^ tables[4][word >> 24 & 0xff] ^
+                       tables[3][word >> 32 & 0xff] ^ tables[2][word >> 40 & 0xff] ^ tables[1][word >> 48 & 0xff] ^ tables[0][word >> 56];
+            }
+
+            for (; n; --n, ++p)
+                 crc = crc >> 8 ^ tables[0][(crc ^ *p) & 0xff];
+
+            return crc;
+        }
+
+#if defined(__x86_64__)
+        __attribute__((target("sse4.2")))
+        uint32_t update_sse42(uint32_t crc, const unsigned char* p, size_t n) const
+        {
+            uint64_t a = crc;
+
+            for (; n >= 3 * lane; n -= 3 * lane, p += 3 * lane)
+            {
+                 uint64_t b = 0;
+                 uint64_t c = 0;
+
+                 for (size_t i = 0; i < lane; i += 8)
+                 {
+                      uint64_t x, y, z;
+
+                      std::memcpy(&x, p + i, 8);
+                      std::memcpy(&y, p + lane + i, 8);
+                      std::memcpy(&z, p + 2 * lane + i, 8);
+
+                      a = _mm_crc32_u64(a, x);
+                      b = _mm_crc32_u64(b, y);
+                      c = _mm_crc32_u64(c, z);
+                 }
+
+                 a = shift(shift(uint32_t(a)) ^ uint32_t(b)) ^ uint32_t(c);
+            }
+
+            for (; n >= 8; n -= 8, p += 8)
+            {
+                 uint64_t x;
+                 std::memcpy(&x, p, 8);
+
+                 a = _mm_crc32_u64(a, x);
+            }
+
+            auto r = uint32_t(a);
+
+            for (; n; --n, ++p)
+                 r = _mm_crc32_u8(r, *p);
+
+            return r;
+        }
+#endif
+
+        table_t tables;
+        std::array<std::array<uint32_t, 256>, 4> shifts;
+
+        bool hardware = false;
+    };
+
+    // crc32c(data, n, crc32c(head, m)) continues a checksum across buffers
+    inline uint32_t crc32c(const void* data, size_t n, uint32_t crc = 0)
+    {
+        return ~crc32c_engine::get().update(~crc, data, n);
+    }
+}
+
+#endif
@@ -0,0 +1,358 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef DELTA_HPP
+#define DELTA_HPP
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <openssl/evp.h>
+
+namespace urpc
+{
+    // the weak checksum of rsync, two 16-bit sums that slide over a window a byte at a time
+    class rolling
+    {
+    public:
+        rolling() = default;
+
+        rolling(const char* data, size_t n) : n(n)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                 a += static_cast<unsigned char>(data[i]);
+                 b += a;
+            }
+        }
+
+        void roll(char out, char in)
+        {
+            a += static_cast<unsigned char>(in) - static_cast<unsigned char>(out);
+            b += a - n * static_cast<unsigned char>(out);
+        }
+
+        uint32_t value() const
+        {
+            return (a & 0xffff) | b << 16;
+        }
+
+    private:
+        uint32_t a = 0;
+        uint32_t b = 0;
+
+        uint32_t n = 0;
+    };
+
+    // md5 as rsync uses it, blocks only have to tell apart accidental weak collisions
+    class digest
+    {
+    public:
+        digest() : ctx(EVP_MD_CTX_new())
+        {
+            EVP_DigestInit_ex(ctx, EVP_md5(), nullptr);
+        }
+
+        digest(const digest&) = delete;
+        digest& operator=(const digest&) = delete;
+
+        void update(const char* data, size_t n)
+        {
+            EVP_DigestUpdate(ctx, data, n);
+        }
+
+        std::string final()
+        {
+            unsigned char md[EVP_MAX_MD_SIZE];
+            unsigned int n = 0;
+
+            EVP_DigestFinal_ex(ctx, md, &n);
+            EVP_DigestInit_ex(ctx, EVP_md5(), nullptr);
+
+            return std::string(reinterpret_cast<char*>(md), n);
+        }
+
+        static std::string of(const char* data, size_t n)
+        {
+            digest d;
+            d.update(data, n);
+
+            return d.final();
+        }
+
+        ~digest()
+        {
+            EVP_MD_CTX_free(ctx);
+        }
+
+    private:
+        EVP_MD_CTX* ctx;
+    };
+
+    // about the square root of the size as rsync picks it, so signatures and literals grow alike
+    inline uint32_t block_size(uint64_t size)
+    {
+        auto n = uint64_t(std::sqrt(double(size))) & ~uint64_t(7);
+
+        return std::clamp<uint64_t>(n, 2048, 1 << 20);
+    }
+
+    // a read only view of a whole file
+    class mapping
+    {
+    public:
+        mapping() = default;
+
+        mapping(const std::string& path)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+            if (fd == -1)
+                return;
+
+            if (struct stat st; ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size)
+            {
+                if (auto p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); p != MAP_FAILED)
+                {
+                    data_ = static_cast<const char*>(p);
+                    size_ = st.st_size;
+
+                    ::madvise(p, size_, MADV_SEQUENTIAL);
+                }
+            }
+
+            ::close(fd);
+        }
+
+        mapping(mapping&& other) : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0))
+        {
+        }
+
+        mapping& operator=(mapping&& other)
+        {
+            if (this != &other)
+            {
+                reset();
+
+                data_ = std::exchange(other.data_, nullptr);
+                size_ = std::exchange(other.size_, 0);
+            }
+
+            return *this;
+        }
+
+        const char* data() const
+        {
+            return data_;
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+
+        explicit operator bool() const
+        {
+            return data_;
+        }
+
+        // starts reading up to n bytes from offset in, so they are in memory by the time they are touched
+        void prefetch(size_t offset, size_t n) const
+        {
+            if (offset >= size_)
+                return;
+
+            static const size_t page = ::sysconf(_SC_PAGESIZE);
+            size_t from = offset & ~(page - 1);
+
+            ::madvise(const_cast<char*>(data_) + from, std::min(n, size_ - offset) + offset - from, MADV_WILLNEED);
+        }
+
+        void reset()
+        {
+            if (data_)
+                ::munmap(const_cast<char*>(data_), size_);
+
+            data_ = nullptr;
+            size_ = 0;
+        }
+
+        ~mapping()
+        {
+            reset();
+        }
+
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // calls f(weak, strong) for every whole block of the data, a trailing partial block is left to the literals
+    template <typename F>
+    void sign(const char* data, size_t size, uint32_t block, F&& f)
+    {
+        for (size_t i = 0; i + block <= size; i += block)
+             f(rolling(data + i, block).value(), digest::of(data + i, block));
+    }
+
+    // the blocks of the old copy by weak checksum, the strong one is only computed on a weak hit
+    class signatures
+    {
+    public:
+        signatures(uint32_t block) : block_(block)
+        {
+        }
+
+        void add(uint32_t weak, const std::string& strong)
+        {
+            blocks.emplace_back(weak, strong);
+            index[weak].push_back(blocks.size() - 1);
+        }
+
+        uint32_t block() const
+        {
+            return block_;
+        }
+
+        bool empty() const
+        {
+            return blocks.empty();
+        }
+
+        // the block following the previous match wins among equals, so runs of unchanged blocks stay runs
+        int64_t find(uint32_t weak, const char* data, uint64_t hint) const
+        {
+            auto it = index.find(weak);
+
+            if (it == index.end())
+                return -1;
+
+            if (hint < blocks.size() && blocks[hint].first == weak)
+            {
+                if (digest::of(data, block_) == blocks[hint].second)
+                    return hint;
+            }
+
+            std::string strong;
+
+            for (auto i : it->second)
+            {
+                 if (i == hint || blocks[i].first != weak)
+                     continue;
+
+                 if (strong.empty())
+                     strong = digest::of(data, block_);
+
+                 if (strong == blocks[i].second)
+                     return i;
+            }
+
+            return -1;
+        }
+
+    private:
+        uint32_t block_;
+
+        std::vector<std::pair<uint32_t, std::string>> blocks;
+        std::unordered_map<uint32_t, std::vector<uint64_t>> index;
+    };
+
+    // walks the new copy against the signatures of the old one, emitting literal(data, n) for bytes the old copy lacks
+    // and copy(block, data) for blocks it has, in order; next returns once literal bytes are pending or span bytes were
+    // covered, and false after the last of them
+    class delta
+    {
+    public:
+        delta(const char* data, size_t size, const signatures& sigs) : data(data), size(size), sigs(sigs), block(sigs.block())
+        {
+        }
+
+        template <typename L, typename C>
+        bool next(size_t literal, size_t span, L&& l, C&& c)
+        {
+            size_t from = pos;
+
+            while (pos + block <= size)
+            {
+                if (!valid)
+                {
+                    weak = rolling(data + pos, block);
+                    valid = true;
+                }
+
+                if (auto i = sigs.find(weak.value(), data + pos, hint); i != -1)
+                {
+                    if (pos > lit)
+                        l(data + lit, pos - lit);
+
+                    c(uint64_t(i), data + pos);
+
+                    hint = i + 1;
+                    pos += block;
+
+                    lit = pos;
+                    valid = false;
+
+                    if (pos - from >= span)
+                        return true;
+
+                    continue;
+                }
+
+                if (pos - lit >= literal)
+                {
+                    l(data + lit, pos - lit);
+                    lit = pos;
+
+                    return true;
+                }
+
+                if (pos + block < size)
+                    weak.roll(data[pos], data[pos + block]);
+                else
+                    valid = false;
+
+                ++pos;
+            }
+
+            pos = size;
+
+            if (lit < size)
+                l(data + lit, size - lit);
+
+            lit = size;
+
+            return false;
+        }
+
+    private:
+        const char* data;
+        size_t size;
+
+        const signatures& sigs;
+        uint32_t block;
+
+        size_t pos = 0;
+        size_t lit = 0;
+
+        uint64_t hint = 0;
+
+        rolling weak;
+        bool valid = false;
+    };
+}
+
+#endif
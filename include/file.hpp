@@ -0,0 +1,635 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef FILE_HPP
+#define FILE_HPP
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <coroutine>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unordered_map>
+#include <linux/io_uring.h>
+#include <monitor.hpp>
+
+namespace urpc
+{
+    // a buffer O_DIRECT accepts, its address and length are multiples of the alignment
+    struct aligned_buffer
+    {
+        aligned_buffer(size_t n, size_t alignment = 4096) : size((n + alignment - 1) / alignment * alignment)
+        {
+            void* p = nullptr;
+
+            if (::posix_memalign(&p, alignment, std::max(size, alignment)) == 0)
+                data.reset(static_cast<char*>(p));
+        }
+
+        struct deleter
+        {
+            void operator()(char* p) const
+            {
+                std::free(p);
+            }
+        };
+
+        std::unique_ptr<char, deleter> data;
+        size_t size;
+    };
+
+    // disk operations off the network loop: unp drives sockets and timers on its ring but not files, so each
+    // network ring gets a companion ring for them; while operations are in flight a timer of the loop reaps
+    // their completions, right away after progress and backing off up to about a millisecond without it
+    class file_ring : public std::enable_shared_from_this<file_ring>
+    {
+    public:
+        // the result as io_uring reports it, negative errno on failure
+        using handler_t = std::function<void(int)>;
+
+        using rings_t = std::unordered_map<net::io_uring_context*, std::weak_ptr<file_ring>>;
+
+        // the companion of a loop lives as long as someone holds it or an operation on it is in flight, so it
+        // goes before its loop does and a loop at the same address later gets a fresh one; whoever does disk
+        // I/O on a loop for long holds on to it, rather than having it set up again for every burst
+        static std::shared_ptr<file_ring> of(net::io_uring_context& ioc)
+        {
+            static std::mutex mutex;
+            static rings_t rings;
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            std::erase_if(rings, [](auto& p){ return p.second.expired(); });
+            auto& w = rings[&ioc];
+
+            auto r = w.lock();
+
+            if (!r)
+                w = r = std::make_shared<file_ring>(ioc);
+
+            return r;
+        }
+
+        file_ring(net::io_uring_context& ioc, uint32_t entries = 256) : timer(ioc), monitor(loop_monitor::of(ioc))
+        {
+            io_uring_params params {};
+
+            if (fd = ::syscall(__NR_io_uring_setup, entries, &params); fd == -1)
+                throw std::system_error(errno, std::system_category(), "io_uring_setup");
+
+            try
+            {
+                map(params);
+            }
+            catch (...)
+            {
+                ::close(fd);
+                throw;
+            }
+        }
+
+        file_ring(const file_ring&) = delete;
+        file_ring& operator=(const file_ring&) = delete;
+
+        // paths are copied, buffers must outlive the operation
+        void openat(int dirfd, const std::string& path, int flags, mode_t mode, handler_t handler)
+        {
+            auto o = new op { std::move(handler), path };
+            auto e = prep(IORING_OP_OPENAT, dirfd, o);
+
+            e->addr = uint64_t(o->path.c_str());
+            e->len = mode;
+            e->open_flags = flags | O_CLOEXEC;
+
+            submit(e);
+        }
+
+        void close(int fd, handler_t handler)
+        {
+            auto o = new op { std::move(handler) };
+            submit(prep(IORING_OP_CLOSE, fd, o));
+        }
+
+        void read(int fd, void* data, uint32_t n, uint64_t offset, handler_t handler)
+        {
+            auto o = new op { std::move(handler) };
+            auto e = prep(IORING_OP_READ, fd, o);
+
+            e->addr = uint64_t(data);
+            e->len = n;
+            e->off = offset;
+
+            submit(e);
+        }
+
+        void write(int fd, const void* data, uint32_t n, uint64_t offset, handler_t handler)
+        {
+            auto o = new op { std::move(handler) };
+            auto e = prep(IORING_OP_WRITE, fd, o);
+
+            e->addr = uint64_t(data);
+            e->len = n;
+            e->off = offset;
+
+            submit(e);
+        }
+
+        void fsync(int fd, bool datasync, handler_t handler)
+        {
+            auto o = new op { std::move(handler) };
+            auto e = prep(IORING_OP_FSYNC, fd, o);
+
+            e->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+
+            submit(e);
+        }
+
+        // reserves the blocks of a file whose size is known, so writes neither fragment it nor run out of space midway
+        void fallocate(int fd, int mode, uint64_t offset, uint64_t length, handler_t handler)
+        {
+            auto o = new op { std::move(handler) };
+            auto e = prep(IORING_OP_FALLOCATE, fd, o);
+
+            e->off = offset;
+            e->addr = length;
+            e->len = mode;
+
+            submit(e);
+        }
+
+        void statx(int dirfd, const std::string& path, int flags, uint32_t mask, struct statx* buff, handler_t handler)
+        {
+            auto o = new op { std::move(handler), path };
+            auto e = prep(IORING_OP_STATX, dirfd, o);
+
+            e->addr = uint64_t(o->path.c_str());
+            e->len = mask;
+            e->off = uint64_t(buff);
+            e->statx_flags = flags;
+
+            submit(e);
+        }
+
+        void mkdirat(int dirfd, const std::string& path, mode_t mode, handler_t handler)
+        {
+            auto o = new op { std::move(handler), path };
+            auto e = prep(IORING_OP_MKDIRAT, dirfd, o);
+
+            e->addr = uint64_t(o->path.c_str());
+            e->len = mode;
+
+            submit(e);
+        }
+
+        void renameat(int olddirfd, const std::string& oldpath, int newdirfd, const std::string& newpath, handler_t handler)
+        {
+            auto o = new op { std::move(handler), oldpath, newpath };
+            auto e = prep(IORING_OP_RENAMEAT, olddirfd, o);
+
+            e->addr = uint64_t(o->path.c_str());
+            e->len = newdirfd;
+            e->addr2 = uint64_t(o->other.c_str());
+
+            submit(e);
+        }
+
+        void unlinkat(int dirfd, const std::string& path, int flags, handler_t handler)
+        {
+            auto o = new op { std::move(handler), path };
+            auto e = prep(IORING_OP_UNLINKAT, dirfd, o);
+
+            e->addr = uint64_t(o->path.c_str());
+            e->unlink_flags = flags;
+
+            submit(e);
+        }
+
+        // a regular file takes a write short only when the disk fills up or a signal lands, the rest is resubmitted;
+        // the handler gets 0 once all n bytes are written
+        void write_all(int fd, const void* data, size_t n, uint64_t offset, handler_t handler)
+        {
+            if (!n)
+                return handler(0);
+
+            write(fd, data, std::min<size_t>(n, 1 << 30), offset, [this, fd, data, n, offset, handler = std::move(handler)](int r) mutable
+            {
+                if (r <= 0)
+                    return handler(r ? r : -EIO);
+
+                if (size_t(r) == n)
+                    return handler(0);
+
+                write_all(fd, static_cast<const char*>(data) + r, n - r, offset + r, std::move(handler));
+            });
+        }
+
+        // creates path and its missing parents, the parents only after the path itself turned out to lack them
+        void mkdirs(const std::string& path, mode_t mode, handler_t handler)
+        {
+            mkdirat(AT_FDCWD, path, mode, [this, path, mode, handler = std::move(handler)](int r) mutable
+            {
+                if (r == -EEXIST)
+                    return handler(0);
+
+                auto p = path.find_last_of('/');
+
+                if (r != -ENOENT || p == 0 || p == std::string::npos)
+                    return handler(r);
+
+                mkdirs(path.substr(0, p), mode, [this, path, mode, handler = std::move(handler)](int r) mutable
+                {
+                    if (r < 0)
+                        return handler(r);
+
+                    mkdirat(AT_FDCWD, path, mode, [handler = std::move(handler)](int r)
+                    {
+                        handler(r == -EEXIST ? 0 : r);
+                    });
+                });
+            });
+        }
+
+        size_t pending() const
+        {
+            return inflight;
+        }
+
+        // runs the handlers of the finished operations, a handler may queue further ones; completions that did
+        // not fit the completion queue wait in the kernel until io_uring_enter asks for them
+        // runs the handlers of the finished operations and returns how many ran; a handler may queue further
+        // operations, those finishing meanwhile wait for the next reap
+        size_t reap()
+        {
+            auto self = shared_from_this();
+            harvest();
+
+            auto done = std::exchange(ready, {});
+
+            for (auto& [o, res] : done)
+            {
+                 --inflight;
+
+                 std::unique_ptr<op> owner(o);
+                 owner->handler(res);
+            }
+
+            return done.size();
+        }
+
+        ~file_ring()
+        {
+            ::munmap(sqes, sqes_size);
+
+            if (cq_ptr != sq_ptr)
+                ::munmap(cq_ptr, cq_size);
+
+            ::munmap(sq_ptr, sq_size);
+            ::close(fd);
+        }
+
+    private:
+        struct op
+        {
+            handler_t handler;
+
+            std::string path;
+            std::string other;
+
+            std::shared_ptr<file_ring> ring;
+        };
+
+        // moves the completions out of the queue without running anything, so submitting never calls back into a
+        // handler; completions that did not fit the queue wait in the kernel until io_uring_enter asks for them
+        size_t harvest()
+        {
+            size_t n = 0;
+
+            while (true)
+            {
+                auto head = *cq_head;
+
+                if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+                {
+                    if (!(__atomic_load_n(sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW))
+                        break;
+
+                    ::syscall(__NR_io_uring_enter, fd, 0, 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+                    continue;
+                }
+
+                auto cqe = cqes[head & *cq_mask];
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+
+                ready.emplace_back(reinterpret_cast<op*>(cqe.user_data), cqe.res);
+                ++n;
+            }
+
+            return n;
+        }
+
+        void map(const io_uring_params& params)
+        {
+            sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+            bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+
+            if (single)
+                sq_size = cq_size = std::max(sq_size, cq_size);
+
+            sq_ptr = ::mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            cq_ptr = single ? sq_ptr : ::mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+            sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+
+            if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes == MAP_FAILED)
+                throw std::system_error(errno, std::system_category(), "io_uring mmap");
+
+            auto sq = static_cast<char*>(sq_ptr);
+            auto cq = static_cast<char*>(cq_ptr);
+
+            sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+            sq_mask = reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+            sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+
+            sq_head = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+            sq_flags = reinterpret_cast<uint32_t*>(sq + params.sq_off.flags);
+
+            sq_entries = params.sq_entries;
+
+            cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+            cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+
+            cq_mask = reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        }
+
+        uint32_t queued() const
+        {
+            return *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        }
+
+        // without sqpoll the kernel consumes the submission queue within io_uring_enter, unless it refuses more with
+        // EBUSY or EAGAIN until completions are out of its way; those are harvested, or waited for if none is there
+        void reserve(uint32_t n)
+        {
+            while (queued() + n > sq_entries)
+            {
+                if (enter(); queued() + n <= sq_entries || harvest())
+                    continue;
+
+                if (inflight == ready.size() + queued())
+                    throw std::system_error(errno, std::system_category(), "io_uring_enter");
+
+                ::syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            }
+        }
+
+        io_uring_sqe* next()
+        {
+            reserve(1);
+
+            auto tail = *sq_tail;
+            auto index = tail & *sq_mask;
+
+            auto e = &sqes[index];
+            std::memset(e, 0, sizeof(*e));
+
+            sq_array[index] = index;
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+            return e;
+        }
+
+        io_uring_sqe* prep(uint8_t opcode, int fd, op* o)
+        {
+            auto e = next();
+
+            e->opcode = opcode;
+            e->fd = fd;
+            e->user_data = uint64_t(o);
+
+            o->ring = shared_from_this();
+
+            return e;
+        }
+
+        void submit(io_uring_sqe* e)
+        {
+            ++inflight;
+            enter();
+
+            poll();
+        }
+
+        void enter()
+        {
+            uint32_t n = queued();
+
+            while (n)
+            {
+                auto r = ::syscall(__NR_io_uring_enter, fd, n, 0, 0, nullptr, 0);
+
+                if (r < 0 && errno == EINTR)
+                    continue;
+
+                if (r <= 0)
+                    break;
+
+                n -= r;
+            }
+        }
+
+        // the timer only runs while operations are in flight, so an idle ring has nothing pending on the loop
+        void poll()
+        {
+            if (polling)
+                return;
+
+            polling = true;
+            timer.expires_from_now(std::chrono::microseconds(round ? 20 << std::min(round, 6u) : 0));
+
+            timer.async_wait(monitor->wrap("file_ring::on_poll",
+            [w = weak_from_this()](error_code_t ec)
+            {
+                if (auto self = w.lock())
+                    self->on_poll(ec);
+            }));
+        }
+
+        void on_poll(error_code_t ec)
+        {
+            polling = false;
+
+            if (ec)
+                return;
+
+            round = reap() ? 0 : round + 1;
+
+            if (inflight)
+                poll();
+        }
+
+        int fd = -1;
+
+        void* sq_ptr = nullptr;
+        void* cq_ptr = nullptr;
+
+        size_t sq_size = 0;
+        size_t cq_size = 0;
+
+        io_uring_sqe* sqes = nullptr;
+        size_t sqes_size = 0;
+
+        uint32_t* sq_head;
+        uint32_t* sq_tail;
+
+        uint32_t* sq_mask;
+        uint32_t* sq_array;
+
+        uint32_t* sq_flags;
+        uint32_t sq_entries;
+
+        uint32_t* cq_head;
+        uint32_t* cq_tail;
+
+        uint32_t* cq_mask;
+        io_uring_cqe* cqes;
+
+        size_t inflight = 0;
+        std::vector<std::pair<op*, int>> ready;
+
+        net::steady_timer timer;
+        std::shared_ptr<loop_monitor> monitor;
+
+        uint32_t round = 0;
+        bool polling = false;
+    };
+
+    // the file ring of the loop a server or loopback call runs on, none on the client side
+    inline std::shared_ptr<file_ring> files(RpcController* c)
+    {
+        auto ring = static_cast<controller*>(c)->ring();
+
+        return ring ? file_ring::of(*ring) : nullptr;
+    }
+
+    // resumes the handler on the loop with the io_uring result, negative errno on failure
+    class file_awaiter
+    {
+    public:
+        using submit_t = std::function<void(file_ring::handler_t)>;
+
+        file_awaiter(submit_t submit) : submit(std::move(submit))
+        {
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        // the operation may finish before submit returns, by then the awaiter may be gone with the frame
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            auto f = std::move(submit);
+
+            f([this, h](int r)
+            {
+                result = r;
+                h.resume();
+            });
+        }
+
+        int await_resume() const
+        {
+            return result;
+        }
+
+    private:
+        submit_t submit;
+        int result = 0;
+    };
+
+    // submits through the file ring of the call, a call off any loop gets -ENXIO
+    template <typename F>
+    file_awaiter on_files(RpcController* c, F&& f)
+    {
+        return file_awaiter([r = files(c), f = std::forward<F>(f)](file_ring::handler_t h)
+        {
+            if (!r)
+                return h(-ENXIO);
+
+            f(*r, std::move(h));
+        });
+    }
+
+    // int fd = co_await urpc::async_openat(controller, path, O_RDONLY) and the rest suspend a server handler
+    // on the file ring of its loop, the handler runs done once it is through
+    inline file_awaiter async_openat(RpcController* c, std::string path, int flags, mode_t mode = 0)
+    {
+        return on_files(c, [path = std::move(path), flags, mode](file_ring& r, file_ring::handler_t h)
+        {
+            r.openat(AT_FDCWD, path, flags, mode, std::move(h));
+        });
+    }
+
+    inline file_awaiter async_close(RpcController* c, int fd)
+    {
+        return on_files(c, [fd](file_ring& r, file_ring::handler_t h)
+        {
+            r.close(fd, std::move(h));
+        });
+    }
+
+    inline file_awaiter async_read_at(RpcController* c, int fd, void* data, uint32_t n, uint64_t offset)
+    {
+        return on_files(c, [fd, data, n, offset](file_ring& r, file_ring::handler_t h)
+        {
+            r.read(fd, data, n, offset, std::move(h));
+        });
+    }
+
+    // yields 0 once all n bytes are written
+    inline file_awaiter async_write_at(RpcController* c, int fd, const void* data, size_t n, uint64_t offset)
+    {
+        return on_files(c, [fd, data, n, offset](file_ring& r, file_ring::handler_t h)
+        {
+            r.write_all(fd, data, n, offset, std::move(h));
+        });
+    }
+
+    inline file_awaiter async_fsync(RpcController* c, int fd, bool datasync = false)
+    {
+        return on_files(c, [fd, datasync](file_ring& r, file_ring::handler_t h)
+        {
+            r.fsync(fd, datasync, std::move(h));
+        });
+    }
+
+    inline file_awaiter async_statx(RpcController* c, std::string path, struct statx* buff, uint32_t mask = STATX_BASIC_STATS, int flags = 0)
+    {
+        return on_files(c, [path = std::move(path), buff, mask, flags](file_ring& r, file_ring::handler_t h)
+        {
+            r.statx(AT_FDCWD, path, flags, mask, buff, std::move(h));
+        });
+    }
+}
+
+#endif
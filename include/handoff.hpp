@@ -0,0 +1,124 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+#include <system_error>
+#include <fcntl.h>
+#include <sys/un.h>
+#include <transport.hpp>
+
+namespace urpc
+{
+    // the listening socket of a server that handed it over, see server::handoff
+    struct inheritance
+    {
+        int fd = -1;
+        bool shm = false;
+
+        explicit operator bool() const
+        {
+            return fd != -1;
+        }
+    };
+
+    // only a process of the same user may take the listener, and with it the traffic of this server
+    inline bool trusted(int socket)
+    {
+        ucred cred {};
+        socklen_t len = sizeof(cred);
+
+        if (::getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+            return false;
+
+        return cred.uid == ::geteuid();
+    }
+
+    // wraps an inherited listening socket for server(ioc, listener), which owns it afterwards; the acceptor is
+    // bound on a placeholder address as any other, then the inherited socket is put in place of its descriptor
+    inline listener adopt(net::io_uring_context& ioc, const inheritance& from)
+    {
+        sockaddr_storage addr {};
+        socklen_t len = sizeof(addr);
+
+        if (::getsockname(from.fd, reinterpret_cast<sockaddr*>(&addr), &len) == -1)
+            throw std::system_error(errno, std::system_category(), "getsockname");
+
+        auto take = [&](auto& acceptor)
+        {
+            if (::dup3(from.fd, acceptor.native_handle(), O_CLOEXEC) == -1)
+                throw std::system_error(errno, std::system_category(), "dup3");
+
+            ::close(from.fd);
+        };
+
+        if (addr.ss_family == AF_UNIX)
+        {
+            auto name = std::string(1, '\0') + "urpc.adopt." + std::to_string(::getpid()) + "." + std::to_string(from.fd);
+            listener::acceptor_v acceptor(std::in_place_type<local::acceptor>, ioc, local::endpoint(name));
+
+            take(std::get<local::acceptor>(acceptor));
+
+            return listener(ioc, std::move(acceptor), from.shm);
+        }
+
+        if (addr.ss_family != AF_INET && addr.ss_family != AF_INET6)
+            throw std::system_error(EAFNOSUPPORT, std::system_category(), "adopt");
+
+        listener::acceptor_v acceptor(std::in_place_type<tcp::acceptor>, ioc, tcp::endpoint(addr.ss_family == AF_INET6 ? tcp::v6() : tcp::v4(), 0));
+        take(std::get<tcp::acceptor>(acceptor));
+
+        return listener(ioc, std::move(acceptor), from.shm);
+    }
+
+    // asks the running server offering its listener on path for it, an empty result means there was none, or
+    // that it did not answer within timeout milliseconds, and the new server binds its own
+    inline inheritance inherit(const std::string& path, uint32_t timeout = 1000)
+    {
+        inheritance from;
+        std::string name = path;
+
+        if (!name.empty() && name[0] == '@')
+            name[0] = '\0';
+
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+
+        if (name.size() >= sizeof(addr.sun_path))
+            return from;
+
+        std::memcpy(addr.sun_path, name.data(), name.size());
+
+        int s = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (s == -1)
+            return from;
+
+        // a server stuck in its loop must not hang the one taking over, connect and receive both give up
+        timeval tv { timeout / 1000, timeout % 1000 * 1000 };
+
+        ::setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        ::setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        if (::connect(s, reinterpret_cast<sockaddr*>(&addr), offsetof(sockaddr_un, sun_path) + name.size()) == 0)
+        {
+            char tag = 0;
+
+            from.fd = recv_fd(s, tag);
+            from.shm = tag == 's';
+        }
+
+        ::close(s);
+
+        return from;
+    }
+}
+
+#endif
@@ -10,7 +10,9 @@
 #ifndef HEADER_HPP
 #define HEADER_HPP
 
+#include <string_view>
 #include <unordered_map>
+#include <crc32c.hpp>
 #include <controller.hpp>
 
 namespace urpc
@@ -18,6 +20,8 @@ namespace urpc
     struct request
     {
         uint64_t id; 
+        uint32_t timeout;
+
         std::string name;
     };
 
@@ -29,14 +33,61 @@ namespace urpc
         std::string message;
     };
 
+    enum frame
+    {
+        CALL,
+        REPLY,
+        CANCEL,
+        BATCH,
+        PING,
+        PONG,
+        GOAWAY
+    };
+
+    // a frame flagged CHECKSUM is followed by the CRC32C of its header and data; a reply carries one
+    // whenever its call did. servers flag every frame they send VERIFIES, clients hold the trailer
+    // back until they have seen it, a server that does not know the flag would misread the trailer
+    enum flag : uint16_t
+    {
+        CHECKSUM = 1,
+        VERIFIES = 2
+    };
+
     struct header
     {
         uint32_t rpc_len;
         uint32_t arg_len;
 
+        uint16_t type;
+        uint16_t flags;
+
         char data[];
     };
 
+    inline constexpr uint32_t trailer(uint16_t flags)
+    {
+        return flags & CHECKSUM ? sizeof(uint32_t) : 0;
+    }
+
+    // the frame must have room for the trailer
+    inline void seal(header* buff)
+    {
+        uint32_t n = sizeof(header) + buff->rpc_len + buff->arg_len;
+        uint32_t crc = crc32c(buff, n);
+
+        std::memcpy(reinterpret_cast<char*>(buff) + n, &crc, sizeof(crc));
+    }
+
+    inline bool verify(const header* buff)
+    {
+        uint32_t n = sizeof(header) + buff->rpc_len + buff->arg_len;
+        uint32_t crc;
+
+        std::memcpy(&crc, reinterpret_cast<const char*>(buff) + n, sizeof(crc));
+
+        return crc32c(buff, n) == crc;
+    }
+
     inline constexpr bool allocate(header*& buff, uint32_t& size, uint32_t count)
     {
         if (!buff || size < count)
@@ -54,6 +105,62 @@ namespace urpc
         return true;
     }
 
+    // batch entries are packed back to back as 32-bit fields and length prefixed bytes
+    inline char* put(char* p, const void* src, size_t n)
+    {
+        std::memcpy(p, src, n);
+
+        return p + n;
+    }
+
+    inline bool take(const char*& p, const char* end, void* dst, size_t n)
+    {
+        if (size_t(end - p) < n)
+            return false;
+
+        std::memcpy(dst, p, n);
+        p += n;
+
+        return true;
+    }
+
+    // the entries of a batch frame follow their count, a method name and a request each, both length prefixed
+    class batch_reader
+    {
+    public:
+        batch_reader(const char* p, const char* end) : p(p), end(end)
+        {
+        }
+
+        // every entry takes two lengths at least, a count the frame cannot hold is not trusted with an allocation
+        bool count(uint32_t& n)
+        {
+            return take(p, end, &n, sizeof(n)) && n <= size_t(end - p) / (2 * sizeof(uint32_t));
+        }
+
+        bool next(std::string_view& name, std::string_view& request)
+        {
+            return field(name) && field(request);
+        }
+
+    private:
+        bool field(std::string_view& v)
+        {
+            uint32_t len;
+
+            if (!take(p, end, &len, sizeof(len)) || size_t(end - p) < len)
+                return false;
+
+            v = { p, len };
+            p += len;
+
+            return true;
+        }
+
+        const char* p;
+        const char* end;
+    };
+
     template <bool B, typename U, typename L, typename S, typename T>
     constexpr decltype(auto) copy(L&& l, S&& s, T&& t, size_t size = sizeof(U))
     {
@@ -68,8 +175,8 @@ namespace urpc
         return size;
     }
 
-    template <bool B, typename T>
-    constexpr decltype(auto) copy(header* buff, T& t, std::string& m)
+    template <bool B, typename T, typename M>
+    constexpr decltype(auto) copy(header* buff, T& t, M& m)
     {
         size_t l = 0;
         size_t size = m.size();
@@ -81,12 +188,18 @@ namespace urpc
         else
         {
             l += copy<B, uint64_t>(l, s, t.id);
-            l += copy<B, status>(l, s, t.status);
+
+            if constexpr(requires { t.status; })
+                l += copy<B, status>(l, s, t.status);
+            else
+                l += copy<B, uint32_t>(l, s, t.timeout);
         }
 
         l += copy<B, size_t>(l, s, size);
 
-        m.resize(size);
+        if constexpr(!B)
+            m.resize(size);
+
         l += copy<B, size_t>(l, s, m[0], size);
     }
 }
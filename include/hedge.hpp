@@ -0,0 +1,199 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef HEDGE_HPP
+#define HEDGE_HPP
+
+#include <array>
+#include <policy.hpp>
+
+namespace urpc
+{
+    struct hedging
+    {
+        hedging(const hedge_policy& policy) : policy(policy), budget(policy.ratio, policy.burst)
+        {
+        }
+
+        hedge_policy policy;
+
+        urpc::budget budget;
+        urpc::latency latency;
+
+        uint32_t next = 0;
+    };
+
+    template <typename T>
+    class hedge : public std::enable_shared_from_this<hedge<T>>
+    {
+    public:
+        struct attempt : public Closure
+        {
+            void Run()
+            {
+                owner->on_attempt(*this);
+            }
+
+            hedge* owner = nullptr;
+            urpc::controller controller;
+
+            std::unique_ptr<Message> response;
+            bool pending = false;
+        };
+
+        hedge(T& channel, net::io_uring_context& ioc, hedging& state, const MethodDescriptor* method, const std::string* name, controller* c, const Message* request, Message* response, Closure* done) :
+        channel(channel), timer(ioc), state(state), method(method), name(name), c(c), request(request), response(response), done(done)
+        {
+        }
+
+        void run()
+        {
+            self = this->shared_from_this();
+            start = steady_t::now();
+
+            state.budget.deposit();
+            c->canceller([this]{ cancel(); });
+
+            launch(attempts[0], c->host(), c->port(), response);
+
+            if (auto n = delay(); n)
+            {
+                timer.expires_from_now(std::chrono::microseconds(n));
+
+                timer.async_wait(channel.monitor().wrap("hedge::on_timer",
+                [self = this->shared_from_this()](error_code_t ec)
+                {
+                    self->on_timer(ec);
+                }));
+            }
+        }
+
+        uint64_t delay()
+        {
+            if (state.policy.delay)
+                return state.policy.delay * 1000;
+
+            if (state.latency.size() < state.policy.warmup)
+                return 0;
+
+            return state.latency.percentile(state.policy.percentile);
+        }
+
+        void launch(attempt& a, const std::string& host, const std::string& port, Message* target)
+        {
+            a.owner = this;
+            a.pending = true;
+
+            ++pending;
+
+            auto& controller = a.controller;
+
+            controller.host(host);
+            controller.port(port);
+
+            if (auto n = c->timeout(); n)
+            {
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(steady_t::now() - start).count();
+                controller.timeout(elapsed < n ? n - elapsed : 1);
+            }
+
+            channel.dispatch(method, name, &controller, request, target, &a);
+        }
+
+        void on_timer(error_code_t ec)
+        {
+            if (ec || finished || !attempts[0].pending)
+                return;
+
+            auto& backups = c->backups();
+
+            if (backups.empty() || !state.budget.withdraw())
+                return;
+
+            auto& [host, port] = backups[state.next++ % backups.size()];
+            auto& a = attempts[1];
+
+            a.response.reset(response->New());
+            launch(a, host, port, a.response.get());
+        }
+
+        void on_attempt(attempt& a)
+        {
+            auto keep = this->shared_from_this();
+
+            a.pending = false;
+            --pending;
+
+            if (!finished && (!a.controller.Failed() || !pending))
+                finish(a);
+
+            if (finished && !pending)
+                self.reset();
+        }
+
+        void finish(attempt& a)
+        {
+            finished = true;
+
+            timer.cancel();
+            c->canceller(nullptr);
+
+            if (a.controller.Failed())
+                c->SetFailed(a.controller.ErrorText(), a.controller.ErrorCode());
+            else
+            {
+                state.latency.add(steady_t::now() - start);
+
+                if (a.response)
+                    response->GetReflection()->Swap(response, a.response.get());
+            }
+
+            for (auto& other : attempts)
+            {
+                 if (other.pending)
+                     other.controller.StartCancel();
+            }
+
+            done->Run();
+        }
+
+        void cancel()
+        {
+            for (auto& a : attempts)
+            {
+                 if (a.pending)
+                     a.controller.StartCancel();
+            }
+        }
+
+    private:
+        T& channel;
+        net::steady_timer timer;
+
+        hedging& state;
+        const MethodDescriptor* method;
+        const std::string* name;
+
+        controller* c;
+        const Message* request;
+
+        Message* response;
+        Closure* done;
+
+        std::array<attempt, 2> attempts;
+        std::shared_ptr<hedge> self;
+
+        time_point_t start;
+        uint32_t pending = 0;
+
+        bool finished = false;
+    };
+}
+
+#endif
@@ -0,0 +1,190 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef KEEPALIVE_HPP
+#define KEEPALIVE_HPP
+
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <monitor.hpp>
+
+namespace urpc
+{
+    struct keepalive_options
+    {
+        // milliseconds between sweeps, the resolution of the limits below
+        uint32_t interval = 1000;
+
+        // a client pings a connection that has carried no frame for this long
+        uint32_t ping = 10000;
+
+        // milliseconds a ping may go unanswered before the connection is declared dead
+        uint32_t timeout = 3000;
+
+        // a server reaps a session silent this long, a client closes a connection unused this long, 0 keeps them
+        uint32_t idle = 60000;
+    };
+
+    // one timer per ring sweeps every server and channel on it, so connections need no timers of their own
+    class heartbeat : public std::enable_shared_from_this<heartbeat>
+    {
+    public:
+        using sweep_t = std::function<void(time_point_t)>;
+        using sweeps_t = std::map<uint64_t, std::pair<uint32_t, sweep_t>>;
+
+        using beats_t = std::unordered_map<net::io_uring_context*, std::shared_ptr<heartbeat>>;
+
+        class subscription
+        {
+        public:
+            subscription(net::io_uring_context& ioc, uint32_t interval, sweep_t sweep) : beat(heartbeat::of(ioc))
+            {
+                id = beat->subscribe(interval, std::move(sweep));
+            }
+
+            subscription(const subscription&) = delete;
+            subscription& operator=(const subscription&) = delete;
+
+            ~subscription()
+            {
+                beat->unsubscribe(id);
+            }
+
+        private:
+            std::shared_ptr<heartbeat> beat;
+            uint64_t id;
+        };
+
+        heartbeat(net::io_uring_context& ioc) : ioc(ioc), timer(ioc), monitor(loop_monitor::of(ioc))
+        {
+        }
+
+        static std::mutex& mutex()
+        {
+            static std::mutex m;
+
+            return m;
+        }
+
+        static beats_t& beats()
+        {
+            static beats_t b;
+
+            return b;
+        }
+
+        static std::shared_ptr<heartbeat> of(net::io_uring_context& ioc)
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            auto& b = beats()[&ioc];
+
+            if (!b)
+                b = std::make_shared<heartbeat>(ioc);
+
+            return b;
+        }
+
+        // the shortest interval asked for wins, it takes effect from the next tick
+        uint64_t subscribe(uint32_t interval, sweep_t sweep)
+        {
+            interval = std::max<uint32_t>(interval, 1);
+            sweeps.try_emplace(++id, interval, std::move(sweep));
+
+            if (!period || interval < period)
+                period = interval;
+
+            if (!armed)
+                arm();
+
+            return id;
+        }
+
+        // the period goes back up to the shortest interval left, the last one out stops the timer and
+        // retires the heartbeat, a pending tick keeps it alive
+        void unsubscribe(uint64_t n)
+        {
+            sweeps.erase(n);
+
+            if (!sweeps.empty())
+            {
+                period = std::min_element(sweeps.begin(), sweeps.end(), [](auto& a, auto& b){ return a.second.first < b.second.first; })->second.first;
+
+                return;
+            }
+
+            period = 0;
+            timer.cancel();
+
+            std::lock_guard<std::mutex> lock(mutex());
+
+            if (auto it = beats().find(&ioc); it != beats().end() && it->second.get() == this)
+                beats().erase(it);
+        }
+
+        void arm()
+        {
+            armed = true;
+            timer.expires_from_now(std::chrono::milliseconds(period));
+
+            timer.async_wait(monitor->wrap("heartbeat::on_tick",
+            [self = shared_from_this()](error_code_t ec)
+            {
+                self->on_tick(ec);
+            }));
+        }
+
+        void on_tick(error_code_t ec)
+        {
+            armed = false;
+
+            if (sweeps.empty())
+                return;
+
+            if (!ec)
+            {
+                auto now = steady_t::now();
+
+                std::vector<uint64_t> ids;
+                ids.reserve(sweeps.size());
+
+                for (auto& [n, _] : sweeps)
+                     ids.push_back(n);
+
+                // a sweep may tear down its own owner or another one, which unsubscribes it, so each is looked
+                // up again and the closure runs from a copy
+                for (auto n : ids)
+                {
+                     if (auto it = sweeps.find(n); it != sweeps.end())
+                     {
+                         auto sweep = it->second.second;
+                         sweep(now);
+                     }
+                }
+            }
+
+            if (!armed && !sweeps.empty())
+                arm();
+        }
+
+    private:
+        net::io_uring_context& ioc;
+        net::steady_timer timer;
+
+        std::shared_ptr<loop_monitor> monitor;
+        sweeps_t sweeps;
+
+        uint64_t id = 0;
+        uint32_t period = 0;
+
+        bool armed = false;
+    };
+}
+
+#endif
@@ -0,0 +1,137 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef LIMITER_HPP
+#define LIMITER_HPP
+
+#include <cmath>
+#include <algorithm>
+#include <controller.hpp>
+
+namespace urpc
+{
+    struct limiter_options
+    {
+        uint32_t initial = 20;
+
+        uint32_t min = 4;
+        uint32_t max = 1000;
+
+        // samples folded into one limit update
+        uint32_t window = 64;
+
+        // how much the short term latency may exceed the no-load latency before the limit shrinks
+        double tolerance = 1.5;
+        double smoothing = 0.2;
+    };
+
+    // gradient based adaptive concurrency limit: the limit follows the ratio between the
+    // long term (no-load) latency and the latency measured over the last window of calls
+    class limiter
+    {
+    public:
+        limiter(const limiter_options& options = {}) : options(options), limit_(options.initial), estimate(options.initial)
+        {
+        }
+
+        // calls in flight keep their slots, the new limit applies to the ones admitted next
+        void configure(const limiter_options& options)
+        {
+            this->options = options;
+
+            limit_ = std::clamp(limit_, options.min, options.max);
+            estimate = limit_;
+        }
+
+        bool acquire()
+        {
+            if (inflight_ >= limit_)
+            {
+                ++rejected_;
+
+                return false;
+            }
+
+            ++inflight_;
+
+            return true;
+        }
+
+        void release()
+        {
+            if (inflight_)
+                --inflight_;
+        }
+
+        void release(std::chrono::nanoseconds rtt)
+        {
+            release();
+
+            sum += rtt.count();
+
+            if (++samples < options.window)
+                return;
+
+            update(sum / samples);
+
+            sum = 0;
+            samples = 0;
+        }
+
+        uint32_t limit() const
+        {
+            return limit_;
+        }
+
+        uint32_t inflight() const
+        {
+            return inflight_;
+        }
+
+        uint64_t rejected() const
+        {
+            return rejected_;
+        }
+
+    private:
+        void update(double rtt)
+        {
+            if (longterm == 0)
+                longterm = rtt;
+            else
+                longterm = longterm * 0.95 + rtt * 0.05;
+
+            // the load went away, let the baseline catch up quickly
+            if (longterm > rtt * 2)
+                longterm = rtt;
+
+            double gradient = std::clamp(options.tolerance * longterm / rtt, 0.5, 1.0);
+            double target = estimate * gradient + std::sqrt(estimate);
+
+            // kept fractional, a step of less than one slot would otherwise be truncated away at small limits
+            estimate = std::clamp<double>(estimate * (1 - options.smoothing) + target * options.smoothing, options.min, options.max);
+            limit_ = estimate;
+        }
+
+        limiter_options options;
+
+        uint32_t limit_;
+        uint32_t inflight_ = 0;
+
+        uint64_t rejected_ = 0;
+        uint32_t samples = 0;
+
+        double sum = 0;
+        double longterm = 0;
+
+        double estimate;
+    };
+}
+
+#endif
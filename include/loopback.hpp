@@ -0,0 +1,254 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef LOOPBACK_HPP
+#define LOOPBACK_HPP
+
+#include <unordered_map>
+#include <controller.hpp>
+
+namespace urpc
+{
+    // how messages cross the in-process boundary
+    enum passing
+    {
+        SHARE,
+        COPY,
+        SERIALIZE
+    };
+
+    template <typename T>
+    struct direct : public Closure
+    {
+        direct(T& owner, net::io_uring_context& ioc) : owner(owner), timer(ioc)
+        {
+        }
+
+        // the handler may throw after running done, so the call holds itself until then
+        void Run()
+        {
+            if (called)
+                return;
+
+            called = true;
+            owner.on_done(std::move(self));
+        }
+
+        T& owner;
+        urpc::controller controller;
+
+        urpc::controller* c;
+        Closure* closure = nullptr;
+
+        std::unique_ptr<Message> Request;
+        std::unique_ptr<Message> Response;
+
+        Message* response;
+        Closure* done;
+
+        // the deadline of the call, then the post of the caller's done
+        net::steady_timer timer;
+        std::shared_ptr<direct> self;
+
+        bool called = false;
+        bool replied = false;
+    };
+
+    // dispatches straight to services living in the same process, the caller's controller and done
+    // closure behave as with a remote channel: done runs from the ring, never on the caller's stack, and
+    // a call past its timeout fails with TIMEDOUT while its handler is cancelled; SHARE hands the caller's
+    // messages to the service, so a handler outliving the timeout of its call still writes the caller's
+    // response, calls that may time out should use COPY or SERIALIZE
+    class loopback : public RpcChannel
+    {
+    public:
+        using service_t = std::pair<Service*, Closure*>;
+        using services_t = std::unordered_map<std::string, service_t>;
+
+        using direct_t = direct<loopback>;
+        using direct_ptr = std::shared_ptr<direct_t>;
+
+        loopback(net::io_uring_context& ioc, passing mode = SHARE) : ioc(ioc), mode(mode)
+        {
+        }
+
+        bool register_service(Service* service, Closure* closure)
+        {
+            std::string key = service->GetDescriptor()->name();
+
+            if (services_.contains(key))
+                return false;
+
+            services_.try_emplace(key, std::make_pair(service, closure));
+
+            return true;
+        }
+
+        services_t& services()
+        {
+            return services_;
+        }
+
+        void CallMethod(const MethodDescriptor* method, RpcController* Controller, const Message* request, Message* response, Closure* done)
+        {
+            auto c = static_cast<controller*>(Controller);
+            auto d = std::make_shared<direct_t>(*this, ioc);
+
+            d->c = c;
+
+            d->response = response;
+            d->done = done;
+
+            d->controller.ring(&ioc);
+
+            auto it = services_.find(method->service()->name());
+
+            if (it == services_.end())
+                return reply(d, "service not found", UNFOUND);
+
+            auto& [s, closure] = it->second;
+
+            if (method->service() != s->GetDescriptor() && !(method = s->GetDescriptor()->FindMethodByName(method->name())))
+                return reply(d, "method not found", UNFOUND);
+
+            d->closure = closure;
+
+            const Message* Request = request;
+            Message* Response = response;
+
+            if (mode != SHARE)
+            {
+                d->Request.reset(s->GetRequestPrototype(method).New());
+                d->Response.reset(s->GetResponsePrototype(method).New());
+
+                if (mode == COPY)
+                    d->Request->CopyFrom(*request);
+                else if (std::string bytes; !request->SerializeToString(&bytes) || !d->Request->ParseFromString(bytes))
+                    return reply(d, "Cannot SerializeToArray", ERROR);
+
+                Request = d->Request.get();
+                Response = d->Response.get();
+            }
+
+            if (auto n = c->timeout(); n)
+            {
+                d->controller.timeout(n);
+                d->controller.deadline(steady_t::now() + std::chrono::milliseconds(n));
+
+                d->timer.expires_from_now(std::chrono::milliseconds(n));
+
+                d->timer.async_wait(
+                [this, p = std::weak_ptr(d)](error_code_t ec)
+                {
+                    if (auto d = p.lock(); d && !ec)
+                        expire(d);
+                });
+            }
+
+            c->canceller([this, p = std::weak_ptr(d)]
+            {
+                if (auto d = p.lock(); d)
+                    cancel(d);
+            });
+
+            d->self = d;
+
+            try
+            {
+                s->CallMethod(method, &d->controller, Request, Response, d.get());
+            }
+            catch(std::exception& e)
+            {
+                if (!d->called)
+                    d->controller.SetFailed(std::string("Server Internal Error ") + e.what());
+
+                d->Run();
+            }
+        }
+
+        // the caller hears of it now, the handler is told to stop and its done goes nowhere
+        void expire(direct_ptr& d)
+        {
+            reply(d, "deadline exceeded", TIMEDOUT);
+            d->controller.StartCancel();
+        }
+
+        void cancel(direct_ptr& d)
+        {
+            reply(d, "Call cancelled", CANCELED);
+            d->controller.StartCancel();
+        }
+
+        void on_done(direct_ptr d)
+        {
+            if (d->closure)
+                d->closure->Run();
+
+            auto& controller = d->controller;
+            controller.finish();
+
+            if (d->replied)
+                return;
+
+            auto c = d->c;
+
+            if (controller.IsCanceled())
+                c->SetFailed("Call cancelled", CANCELED);
+            else if (controller.Failed())
+                c->SetFailed(controller.ErrorText(), FAILED);
+            else if (mode == COPY)
+                d->response->GetReflection()->Swap(d->response, d->Response.get());
+            else if (mode == SERIALIZE)
+            {
+                std::string bytes;
+
+                if (!d->Response->SerializeToString(&bytes) || !d->response->ParseFromString(bytes))
+                    c->SetFailed("Cannot ParseFromArray", ERROR);
+            }
+
+            reply(d);
+        }
+
+        // the caller's done runs once, from the ring
+        void reply(direct_ptr& d, const std::string& reason = {}, status status = SUCCEED)
+        {
+            if (d->replied)
+                return;
+
+            d->replied = true;
+
+            auto c = d->c;
+            c->canceller(nullptr);
+
+            if (!reason.empty())
+                c->SetFailed(reason, status);
+
+            d->timer.cancel();
+            d->timer.expires_from_now(std::chrono::nanoseconds(0));
+
+            d->timer.async_wait(
+            [d](error_code_t)
+            {
+                d->done->Run();
+            });
+        }
+
+        ~loopback()
+        {
+        }
+
+    private:
+        net::io_uring_context& ioc;
+
+        passing mode;
+        services_t services_;
+    };
+}
+
+#endif
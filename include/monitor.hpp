@@ -0,0 +1,154 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef MONITOR_HPP
+#define MONITOR_HPP
+
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <controller.hpp>
+
+namespace urpc
+{
+    using duration_t = std::chrono::nanoseconds;
+
+    struct loop_stats
+    {
+        // operations urpc has put on the ring and completions it has handled
+        uint64_t submissions = 0;
+        uint64_t completions = 0;
+
+        // operations submitted but not yet completed, i.e. urpc's share of the ring depth
+        uint64_t inflight = 0;
+        uint64_t max_inflight = 0;
+
+        // callbacks that ran longer than the budget
+        uint64_t slow = 0;
+
+        duration_t busy {};
+        duration_t longest {};
+
+        steady_t::time_point since = steady_t::now();
+
+        duration_t elapsed() const
+        {
+            return steady_t::now() - since;
+        }
+
+        // time the loop was not running a urpc callback, i.e. waiting or running foreign work
+        duration_t idle() const
+        {
+            return elapsed() - busy;
+        }
+    };
+
+    class loop_monitor : public std::enable_shared_from_this<loop_monitor>
+    {
+    public:
+        using hook_t = std::function<void(const char*, duration_t)>;
+        using monitors_t = std::unordered_map<net::io_uring_context*, std::weak_ptr<loop_monitor>>;
+
+        // shared by everything urpc runs on a loop and gone with the last of them, so a loop later created at
+        // the same address starts from fresh statistics and the registry does not grow with every loop
+        static std::shared_ptr<loop_monitor> of(net::io_uring_context& ioc)
+        {
+            static std::mutex mutex;
+            static monitors_t monitors;
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            std::erase_if(monitors, [](auto& p){ return p.second.expired(); });
+            auto& w = monitors[&ioc];
+
+            auto m = w.lock();
+
+            if (!m)
+                w = m = std::make_shared<loop_monitor>();
+
+            return m;
+        }
+
+        template <typename F>
+        constexpr decltype(auto) wrap(const char* where, F&& f)
+        {
+            on_submit();
+
+            // a completion may arrive after its owner is gone, it keeps the monitor it counts against
+            return [self = shared_from_this(), where, f = std::forward<F>(f)]<typename... Args>(Args&&... args) mutable
+            {
+                auto begin = steady_t::now();
+                f(std::forward<Args>(args)...);
+
+                self->on_complete(where, steady_t::now() - begin);
+            };
+        }
+
+        void budget(duration_t budget)
+        {
+            budget_ = budget;
+        }
+
+        void hook(hook_t hook)
+        {
+            hook_ = std::move(hook);
+        }
+
+        void reset()
+        {
+            auto inflight = stats_.inflight;
+
+            stats_ = loop_stats();
+            stats_.inflight = inflight;
+        }
+
+        const loop_stats& stats() const
+        {
+            return stats_;
+        }
+
+    private:
+        void on_submit()
+        {
+            ++stats_.submissions;
+
+            if (++stats_.inflight > stats_.max_inflight)
+                stats_.max_inflight = stats_.inflight;
+        }
+
+        void on_complete(const char* where, duration_t period)
+        {
+            ++stats_.completions;
+
+            if (stats_.inflight)
+                --stats_.inflight;
+
+            stats_.busy += period;
+
+            if (period > stats_.longest)
+                stats_.longest = period;
+
+            if (budget_.count() && period > budget_)
+            {
+                ++stats_.slow;
+
+                if (hook_)
+                    hook_(where, period);
+            }
+        }
+
+        loop_stats stats_;
+
+        duration_t budget_ {};
+        hook_t hook_;
+    };
+}
+
+#endif
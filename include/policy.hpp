@@ -0,0 +1,158 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef POLICY_HPP
+#define POLICY_HPP
+
+#include <vector>
+#include <algorithm>
+#include <controller.hpp>
+
+namespace urpc
+{
+    // token bucket bounding the extra load: every call earns ratio tokens, every extra attempt spends one
+    class budget
+    {
+    public:
+        budget(double ratio = 0.1, double cap = 10) : ratio(ratio), cap(cap), tokens(cap)
+        {
+        }
+
+        void deposit()
+        {
+            tokens = std::min(cap, tokens + ratio);
+        }
+
+        bool withdraw()
+        {
+            if (tokens < 1)
+                return false;
+
+            tokens -= 1;
+
+            return true;
+        }
+
+    private:
+        double ratio;
+        double cap;
+
+        double tokens;
+    };
+
+    // percentiles of the most recent call latencies, in microseconds
+    class latency
+    {
+    public:
+        latency(uint32_t capacity = 256) : capacity(capacity)
+        {
+            samples.reserve(capacity);
+        }
+
+        void add(std::chrono::nanoseconds period)
+        {
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(period).count();
+
+            if (samples.size() < capacity)
+                samples.push_back(us);
+            else
+                samples[next] = us;
+
+            next = (next + 1) % capacity;
+            ++fresh;
+        }
+
+        size_t size() const
+        {
+            return samples.size();
+        }
+
+        uint64_t percentile(double p)
+        {
+            if (samples.empty())
+                return 0;
+
+            // refresh once a sixteenth of the window has been replaced
+            if (fresh * 16 >= samples.size() || p != last)
+            {
+                sorted = samples;
+                auto n = std::min<size_t>(sorted.size() * p, sorted.size() - 1);
+
+                std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+
+                value = sorted[n];
+                last = p;
+
+                fresh = 0;
+            }
+
+            return value;
+        }
+
+    private:
+        uint32_t capacity;
+        uint32_t next = 0;
+
+        std::vector<uint64_t> samples;
+        std::vector<uint64_t> sorted;
+
+        double last = 0;
+        uint64_t value = 0;
+
+        uint32_t fresh = 0;
+    };
+
+    struct hedge_policy
+    {
+        // fixed hedge delay in milliseconds, 0 derives it from the observed latency percentile
+        uint32_t delay = 0;
+        double percentile = 0.95;
+
+        // samples required before the percentile is trusted
+        uint32_t warmup = 32;
+
+        // extra calls allowed per call, and the burst of hedges that may accumulate
+        double ratio = 0.05;
+        double burst = 10;
+    };
+
+    struct retry_policy
+    {
+        // failures worth another attempt, application level FAILED is never retried by default
+        std::vector<status> codes { OVERLOADED, UNAVAILABLE };
+
+        // total attempts including the first one
+        uint32_t attempts = 3;
+
+        // exponential backoff in milliseconds, each delay is drawn from [backoff / 2, backoff]
+        uint32_t backoff = 10;
+        uint32_t max_backoff = 1000;
+
+        // retries allowed per call, and the burst of retries that may accumulate
+        double ratio = 0.1;
+        double burst = 10;
+
+        bool retryable(status code) const
+        {
+            return std::find(codes.begin(), codes.end(), code) != codes.end();
+        }
+    };
+
+    struct retrying
+    {
+        retrying(const retry_policy& policy) : policy(policy), budget(policy.ratio, policy.burst)
+        {
+        }
+
+        retry_policy policy;
+        urpc::budget budget;
+    };
+}
+
+#endif
@@ -0,0 +1,154 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef RING_HPP
+#define RING_HPP
+
+#include <stdexcept>
+#include <linux/io_uring.h>
+#include <controller.hpp>
+
+#ifndef IORING_SETUP_COOP_TASKRUN
+#define IORING_SETUP_COOP_TASKRUN (1U << 8)
+#endif
+
+#ifndef IORING_SETUP_TASKRUN_FLAG
+#define IORING_SETUP_TASKRUN_FLAG (1U << 9)
+#endif
+
+#ifndef IORING_SETUP_SINGLE_ISSUER
+#define IORING_SETUP_SINGLE_ISSUER (1U << 12)
+#endif
+
+#ifndef IORING_SETUP_DEFER_TASKRUN
+#define IORING_SETUP_DEFER_TASKRUN (1U << 13)
+#endif
+
+namespace urpc
+{
+    struct ring_options
+    {
+        // submission queue depth, the completion queue is twice as deep unless cq_entries says otherwise
+        uint32_t entries = 1024;
+        uint32_t cq_entries = 0;
+
+        // a kernel thread drains the submission queue, so submitting costs no syscall while it is awake; the loop
+        // has to wake it when the ring flags IORING_SQ_NEED_WAKEUP, which urpc leaves to unp
+        bool sqpoll = false;
+
+        // cpu the poller is pinned to, -1 lets it float
+        int sq_cpu = -1;
+
+        // milliseconds the poller stays awake without work before it sleeps and needs a wakeup
+        uint32_t sq_idle = 1000;
+
+        // completions are run at the next return to user space instead of interrupting the loop
+        bool coop_taskrun = false;
+
+        // completions are run only when the loop waits on the ring, the ring must be driven by one thread
+        bool defer_taskrun = false;
+
+        // microseconds the loop polls for completions before it blocks in io_uring_enter, 0 blocks at once
+        uint32_t spin = 0;
+    };
+
+    inline io_uring_params make_params(const ring_options& options)
+    {
+        if (options.sqpoll && options.defer_taskrun)
+            throw std::invalid_argument("ring: sqpoll and defer_taskrun are mutually exclusive");
+
+        io_uring_params params {};
+
+        if (options.cq_entries)
+        {
+            params.flags |= IORING_SETUP_CQSIZE;
+            params.cq_entries = options.cq_entries;
+        }
+
+        if (options.sqpoll)
+        {
+            params.flags |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = options.sq_idle;
+
+            if (options.sq_cpu >= 0)
+            {
+                params.flags |= IORING_SETUP_SQ_AFF;
+                params.sq_thread_cpu = options.sq_cpu;
+            }
+        }
+
+        if (options.coop_taskrun)
+            params.flags |= IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+
+        if (options.defer_taskrun)
+            params.flags |= IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+
+        return params;
+    }
+
+    // an io_uring_context set up from ring_options, servers and channels take it wherever they take a context
+    class ring
+    {
+    public:
+        ring(const ring_options& options = {}) : options(options), params(make_params(options)), ioc(options.entries, params)
+        {
+        }
+
+        ring(const ring&) = delete;
+        ring& operator=(const ring&) = delete;
+
+        operator net::io_uring_context&()
+        {
+            return ioc;
+        }
+
+        net::io_uring_context& context()
+        {
+            return ioc;
+        }
+
+        const ring_options& config() const
+        {
+            return options;
+        }
+
+        // with spin set, ready completions are reaped for that long before the loop falls asleep on the ring,
+        // which trades a busy core for the wakeup latency of a blocking wait
+        template <typename Token>
+        void run(Token token)
+        {
+            if (!options.spin)
+                return ioc.run(token);
+
+            auto spin = std::chrono::microseconds(options.spin);
+
+            while (!token.stop_requested())
+            {
+                auto until = steady_t::now() + spin;
+
+                while (!token.stop_requested() && steady_t::now() < until)
+                {
+                    if (ioc.poll())
+                        until = steady_t::now() + spin;
+                }
+
+                if (!token.stop_requested())
+                    ioc.run_one();
+            }
+        }
+
+    private:
+        ring_options options;
+        io_uring_params params;
+
+        net::io_uring_context ioc;
+    };
+}
+
+#endif
@@ -0,0 +1,217 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <controller.hpp>
+
+namespace urpc
+{
+    struct scheduler_options
+    {
+        // handlers allowed to run at once, further calls wait in their class
+        uint32_t concurrency = 64;
+
+        // bytes of frames a connection may dispatch per turn within its class
+        uint32_t quantum = 16 << 10;
+
+        // share of the dispatched bytes each class gets while it has work, class 0 first
+        std::vector<uint32_t> weights { 16, 4, 1 };
+    };
+
+    // classes are picked by stride scheduling on their weights, connections within a class by deficit round robin,
+    // both charged by cost, so neither a chatty connection nor a bulk class can starve the rest
+    template <typename T>
+    class scheduler
+    {
+    public:
+        struct flow
+        {
+            std::deque<std::pair<T, uint32_t>> items;
+
+            uint64_t deficit = 0;
+            bool turn = false;
+        };
+
+        struct level
+        {
+            std::unordered_map<uint64_t, flow> flows;
+            std::deque<uint64_t> active;
+
+            uint64_t pass = 0;
+            size_t size = 0;
+        };
+
+        scheduler(const scheduler_options& options) : options(options), levels(std::max<size_t>(options.weights.size(), 1))
+        {
+        }
+
+        uint32_t classes() const
+        {
+            return levels.size();
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+
+        bool empty() const
+        {
+            return !size_;
+        }
+
+        const scheduler_options& config() const
+        {
+            return options;
+        }
+
+        // takes effect with the next pop, items of a class that went away wait in the last one left
+        void configure(const scheduler_options& options)
+        {
+            this->options = options;
+            size_t n = std::max<size_t>(options.weights.size(), 1);
+
+            for (size_t i = n; i < levels.size(); ++i)
+            {
+                 for (auto id : levels[i].active)
+                 {
+                      for (auto& [item, cost] : levels[i].flows.find(id)->second.items)
+                      {
+                           --size_;
+                           push(n - 1, id, std::move(item), cost);
+                      }
+                 }
+            }
+
+            levels.resize(n);
+        }
+
+        // removes everything a flow has queued, in order, as when its connection goes away
+        std::vector<T> drop(uint64_t id)
+        {
+            std::vector<T> items;
+
+            for (auto& l : levels)
+            {
+                 auto it = l.flows.find(id);
+
+                 if (it == l.flows.end())
+                     continue;
+
+                 for (auto& [item, cost] : it->second.items)
+                      items.push_back(std::move(item));
+
+                 l.size -= it->second.items.size();
+                 size_ -= it->second.items.size();
+
+                 l.flows.erase(it);
+                 std::erase(l.active, id);
+            }
+
+            return items;
+        }
+
+        // a class that was idle starts from the current virtual time instead of cashing in its idle period
+        void push(uint32_t cls, uint64_t id, T item, uint32_t cost)
+        {
+            auto& l = levels[std::min<size_t>(cls, levels.size() - 1)];
+
+            if (!l.size)
+                l.pass = std::max(l.pass, now);
+
+            auto [it, fresh] = l.flows.try_emplace(id);
+            it->second.items.emplace_back(std::move(item), std::max<uint32_t>(cost, 1));
+
+            if (fresh)
+                l.active.push_back(id);
+
+            ++l.size;
+            ++size_;
+        }
+
+        T pop()
+        {
+            size_t c = 0;
+
+            for (size_t i = 1; i < levels.size(); ++i)
+            {
+                 if (levels[i].size && (!levels[c].size || levels[i].pass < levels[c].pass))
+                     c = i;
+            }
+
+            auto& l = levels[c];
+            auto [item, cost] = take(l);
+
+            now = l.pass;
+            l.pass += uint64_t(cost) * 1024 / weight(c);
+
+            --l.size;
+            --size_;
+
+            return std::move(item);
+        }
+
+    private:
+        uint32_t weight(size_t c) const
+        {
+            return c < options.weights.size() && options.weights[c] ? options.weights[c] : 1;
+        }
+
+        // the flow at the head keeps its turn while its deficit covers the next item, then goes to the back
+        std::pair<T, uint32_t> take(level& l)
+        {
+            while (true)
+            {
+                auto id = l.active.front();
+                auto& f = l.flows.find(id)->second;
+
+                if (!f.turn)
+                {
+                    f.deficit += options.quantum;
+                    f.turn = true;
+                }
+
+                if (auto cost = f.items.front().second; cost <= f.deficit)
+                {
+                    f.deficit -= cost;
+
+                    auto item = std::move(f.items.front());
+                    f.items.pop_front();
+
+                    if (f.items.empty())
+                    {
+                        l.active.pop_front();
+                        l.flows.erase(id);
+                    }
+
+                    return item;
+                }
+
+                f.turn = false;
+
+                l.active.pop_front();
+                l.active.push_back(id);
+            }
+        }
+
+        scheduler_options options;
+        std::vector<level> levels;
+
+        uint64_t now = 0;
+        size_t size_ = 0;
+    };
+}
+
+#endif
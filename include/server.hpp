@@ -10,17 +10,119 @@
 #ifndef SERVER_HPP
 #define SERVER_HPP
 
+#include <deque>
+#include <array>
+#include <optional>
 #include <header.hpp>
+#include <tls.hpp>
+#include <cache.hpp>
+#include <limiter.hpp>
+#include <skeleton.hpp>
+#include <scheduler.hpp>
+#include <handoff.hpp>
+#include <keepalive.hpp>
+#include <monitor.hpp>
 
 namespace urpc
 {
+    template <typename T>
+    struct context : public Closure, public std::enable_shared_from_this<context<T>>
+    {
+        using message_ptr = std::unique_ptr<Message>;
+
+        context(std::shared_ptr<T> session, uint64_t id) : session(std::move(session)), id(id)
+        {
+        }
+
+        void set_res(status status, const std::string& message)
+        {
+            res.id = id;
+
+            res.status = status;
+            res.message = message;
+        }
+
+        void Run()
+        {
+            if (called)
+                return;
+
+            called = true;
+
+            auto keep = std::move(self);
+            auto s = std::move(session);
+            s->on_done(this->shared_from_this());
+
+            // the slot is given back last, it may start the next call right here
+            if (scheduled)
+                s->owner().finished();
+        }
+
+        std::shared_ptr<T> session;
+
+        // held from dispatch until done runs, the handler may outlive the connection that brought the call
+        std::shared_ptr<context> self;
+
+        urpc::controller controller;
+        Closure* closure = nullptr;
+
+        Service* service = nullptr;
+        const MethodDescriptor* method = nullptr;
+
+        urpc::skeleton* skeleton = nullptr;
+        uint32_t index = 0;
+
+        // a batch frame owns its items until the reply is written, each item points back to it while running
+        std::vector<std::shared_ptr<context>> batch;
+        std::shared_ptr<context> parent;
+
+        uint32_t left = 0;
+
+        // a miss remembers where its response goes, a hit carries the serialized response
+        response_cache* cache = nullptr;
+        response_cache::value_t cached;
+
+        uint64_t hash = 0;
+        std::string key;
+
+        message_ptr Request;
+        message_ptr Response;
+
+        std::array<limiter*, 2> limiters {};
+        time_point_t start;
+
+        response res;
+        header* buff = nullptr;
+
+        uint64_t id;
+        uint32_t size = 0;
+
+        uint32_t count = 0;
+        bool called = false;
+
+        bool scheduled = false;
+        bool checksum = false;
+
+        ~context()
+        {
+            if (buff && size)
+            {
+                size = 0;
+                free(buff);
+            }
+        }
+    };
+
     template <typename T>
     class session : public std::enable_shared_from_this<session<T>>
     {
     public:
-        using message_ptr = std::unique_ptr<Message>;
+        using context_t = std::shared_ptr<context<session<T>>>;
 
-        session(T& server, socket_t socket) : server(server), socket(std::move(socket))
+        using calls_t = std::unordered_map<uint64_t, context_t>;
+        using queue_t = std::deque<context_t>;
+
+        session(T& server, stream socket) : server(server), socket(std::move(socket))
         {
         }
 
@@ -29,27 +131,74 @@ namespace urpc
             return this->shared_from_this();
         }
 
-        void set_res(uint64_t id, status status, const std::string& message)
+        T& owner()
         {
-            res.id = id;
-
-            res.status = status;
-            res.message = message;
+            return server;
         }
 
         void close()
         {
             server.remove(uint64_t(this));
 
+            auto queued = server.withdraw(uint64_t(this));
+            uint32_t slots = 0;
+
+            // a done run by the cancellation erases from calls, so they are walked out of it
+            for (auto& [_, ctx] : std::exchange(calls, {}))
+            {
+                 cancel(ctx);
+                 release(ctx);
+
+                 slots += std::exchange(ctx->scheduled, false);
+            }
+
+            // calls still waiting for a slot complete cancelled without ever starting
+            for (auto& ctx : queued)
+                 ctx->Run();
+
+            while (slots--)
+                 server.finished();
+
+            queue.clear();
+
             if (!socket.is_open())
                 return;
 
-            socket.shutdown(socket_t::shutdown_both);
+            socket.shutdown();
             socket.close();
         }
 
         void run()
         {
+            start();
+        }
+
+        void handshake(net::io_uring_context& ioc, tls_context& tls)
+        {
+            std::make_shared<tls_handshake>(ioc, tls, socket,
+            server.monitor().wrap("session::on_handshake",
+            [self = shared_this()](error_code_t ec)
+            {
+                self->on_handshake(ec);
+            }))->run();
+        }
+
+        void on_handshake(error_code_t ec)
+        {
+            if (ec)
+                return close();
+
+            start();
+        }
+
+        // a goaway asked for during the handshake is sent once the connection carries frames
+        void start()
+        {
+            ready = true;
+
+            if (going)
+                notify(GOAWAY);
+
             do_read_header();
         }
 
@@ -58,18 +207,28 @@ namespace urpc
             if (!allocate(buff, size, sizeof(header)))
                 return close();
 
-            net::async_read(socket, net::buffer(buff, sizeof(header)),
+            socket.async_read(buff, sizeof(header),
+            server.monitor().wrap("session::on_read_header",
             [self = shared_this()](error_code_t ec, std::size_t bytes_transferred)
             {
                 self->on_read_header(ec, bytes_transferred);
-            });
+            }));
         }
 
         void on_read_header(error_code_t ec, std::size_t bytes_transferred)
         {
             if (!ec)
             {
-                count = buff->rpc_len + buff->arg_len;
+                arrival = steady_t::now();
+
+                if (buff->type == PING)
+                {
+                    notify(PONG);
+
+                    return do_read_header();
+                }
+
+                count = buff->rpc_len + buff->arg_len + trailer(buff->flags);
 
                 if (!allocate(buff, size, count + sizeof(header)))
                     return close();
@@ -82,117 +241,505 @@ namespace urpc
 
         void do_read_message()
         {
-            net::async_read(socket, net::buffer(buff->data, count),
+            socket.async_read(buff->data, count,
+            server.monitor().wrap("session::on_read_message",
             [self = shared_this()](error_code_t ec, std::size_t bytes_transferred)
             {
                 self->on_read_message(ec, bytes_transferred);
-            });
+            }));
         }
 
         void on_read_message(error_code_t ec, std::size_t bytes_transferred)
         {
             if (!ec)
             {
-                copy<0>(buff, req.id, req.name);
+                // the lengths that framed it cannot be trusted either, so the connection goes
+                if (buff->flags & CHECKSUM && !verify(buff))
+                    return close();
 
-                auto& name = req.name;
-                size_t pos = name.find_first_of('.');
+                if (buff->type == CANCEL)
+                {
+                    if (buff->rpc_len < sizeof(uint64_t))
+                        return close();
 
-                if (pos == std::string::npos)
+                    uint64_t id;
+                    std::memcpy(&id, buff->data, sizeof(id));
+
+                    on_cancel(id);
+
+                    return do_read_header();
+                }
+
+                copy<0>(buff, req, req.name);
+                auto ctx = std::make_shared<context<session<T>>>(shared_this(), req.id);
+                ctx->checksum = buff->flags & CHECKSUM;
+
+                if (req.timeout)
                 {
-                    set_res(req.id, UNFOUND, "invalid method identity");
-                    do_write(nullptr);
+                    ctx->controller.timeout(req.timeout);
+                    ctx->controller.deadline(arrival + std::chrono::milliseconds(req.timeout));
 
-                    return;
+                    if (ctx->controller.expired())
+                        return reply(ctx, TIMEDOUT, "deadline exceeded");
                 }
 
-                auto& srv = server.services();
-                auto it = srv.find(name.substr(0, pos));
+                if (buff->type == BATCH)
+                    return on_batch(ctx);
 
-                if (it == srv.end())
+                if (auto cache = server.cached(req.name); cache)
                 {
-                    set_res(req.id, UNFOUND, "service not found");
-                    do_write(nullptr);
+                    std::string_view bytes(buff->data + buff->rpc_len, buff->arg_len);
+                    auto hash = response_cache::hash(bytes);
 
-                    return;
+                    if (ctx->cached = cache->get(hash, bytes); ctx->cached)
+                        return reply(ctx, SUCCEED, {});
+
+                    ctx->cache = cache;
+                    ctx->hash = hash;
+
+                    ctx->key.assign(bytes);
                 }
 
-                auto& p = it->second;
+                if (auto status = prepare(ctx, req.name, buff->data + buff->rpc_len, buff->arg_len); status == ERROR)
+                    return close();
+                else if (status != SUCCEED)
+                    return reply(ctx, status, ctx->res.message);
+
+                calls.try_emplace(ctx->id, ctx);
+                server.submit(ctx, req.name, uint64_t(this), sizeof(header) + count);
+
+                do_read_header();
+            }
+            else
+                close();
+        }
+
+        // resolves the method, admits the call and parses its request
+        status prepare(context_t& ctx, const std::string& name, const char* data, uint32_t size)
+        {
+            auto& methods = server.methods();
+            ctx->controller.ring(&server.ring());
+
+            if (auto it = methods.find(name); it != methods.end())
+            {
+                auto& [s, id, closure] = it->second;
+
+                if (!admit(ctx, name))
+                    return fail(ctx, OVERLOADED, "server overloaded");
+
+                ctx->skeleton = s;
+                ctx->index = id;
+
+                ctx->closure = closure;
+
+                ctx->Request.reset(s->make_request(id));
+                ctx->Response.reset(s->make_response(id));
+            }
+            else
+            {
+                size_t pos = name.find_first_of('.');
+
+                if (pos == std::string::npos)
+                    return fail(ctx, UNFOUND, "invalid method identity");
+
+                auto& srv = server.services();
+                auto found = srv.find(name.substr(0, pos));
+
+                if (found == srv.end())
+                    return fail(ctx, UNFOUND, "service not found");
+
+                auto& p = found->second;
                 Service* s = p.first;
 
                 const MethodDescriptor* method = s->GetDescriptor()->FindMethodByName(name.substr(pos + 1));
 
                 if (!method)
-                {
-                    set_res(req.id, UNFOUND, "method not found");
-                    do_write(nullptr);
+                    return fail(ctx, UNFOUND, "method not found");
 
-                    return;
-                }
+                if (!admit(ctx, name))
+                    return fail(ctx, OVERLOADED, "server overloaded");
+
+                ctx->service = s;
+                ctx->method = method;
+
+                ctx->closure = p.second;
+
+                ctx->Request.reset(s->GetRequestPrototype(method).New());
+                ctx->Response.reset(s->GetResponsePrototype(method).New());
+            }
+
+            if (!ctx->Request->ParseFromArray(data, size))
+            {
+                release(ctx);
+
+                return fail(ctx, ERROR, "Cannot ParseFromArray");
+            }
+
+            return SUCCEED;
+        }
+
+        status fail(context_t& ctx, status status, const std::string& message)
+        {
+            ctx->set_res(status, message);
+
+            return status;
+        }
+
+        // a call cancelled or past its deadline by the time its handler would start completes without running it
+        void dispatch(context_t& ctx)
+        {
+            if (ctx->controller.expired())
+                ctx->controller.StartCancel();
+
+            if (ctx->controller.IsCanceled())
+                return ctx->Run();
+
+            ctx->self = ctx;
+
+            try
+            {
+                if (ctx->skeleton)
+                    ctx->skeleton->dispatch(ctx->index, &ctx->controller, ctx->Request.get(), ctx->Response.get(), ctx.get());
+                else
+                    ctx->service->CallMethod(ctx->method, &ctx->controller, ctx->Request.get(), ctx->Response.get(), ctx.get());
+            }
+            catch(std::exception& e)
+            {
+                ctx->controller.SetFailed(std::string("Server Internal Error ") + e.what());
+                ctx->Run();
+            }
+        }
+
+        // every item of a batch frame is dispatched in this pass, the reply goes out once the last one is done
+        void on_batch(context_t ctx)
+        {
+            batch_reader reader(buff->data + buff->rpc_len, buff->data + buff->rpc_len + buff->arg_len);
+            uint32_t n;
+
+            if (!reader.count(n))
+                return close();
 
-                message_ptr Request(s->GetRequestPrototype(method).New());
+            ctx->left = n + 1;
+            ctx->batch.reserve(n);
 
-                if (!Request->ParseFromArray(buff->data + buff->rpc_len, buff->arg_len))
+            calls.try_emplace(ctx->id, ctx);
+
+            std::string name;
+            std::string_view method, request;
+
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                if (!reader.next(method, request))
                     return close();
 
-                controller controller;
-                message_ptr Response(s->GetResponsePrototype(method).New());
+                name.assign(method);
 
-                try
-                {
-                    s->CallMethod(method, &controller, Request.get(), Response.get(), p.second);
-                }
-                catch(std::exception& e)
+                auto item = std::make_shared<context<session<T>>>(shared_this(), i);
+                ctx->batch.push_back(item);
+
+                if (auto timeout = ctx->controller.timeout(); timeout)
                 {
-                    controller.SetFailed(std::string("Server Internal Error ") + e.what());
+                    item->controller.timeout(timeout);
+                    item->controller.deadline(ctx->controller.deadline());
                 }
 
-                res.id = req.id;
-                res.status = SUCCEED;
+                auto status = prepare(item, name, request.data(), request.size());
 
-                if (controller.Failed())
+                if (status != SUCCEED)
                 {
-                    res.status = FAILED;
-                    res.message = controller.ErrorText();
+                    --ctx->left;
+                    continue;
                 }
 
-                do_write(Response.get());
+                item->parent = ctx;
+                dispatch(item);
             }
-            else
-                close();
+
+            if (--ctx->left == 0)
+                on_batch_done(ctx);
+
+            do_read_header();
+        }
+
+        void on_batch_done(context_t ctx)
+        {
+            calls.erase(ctx->id);
+
+            if (ctx->controller.IsCanceled() || !socket.is_open())
+                return;
+
+            ctx->set_res(SUCCEED, {});
+            do_write(ctx);
+        }
+
+        void cancel(context_t& ctx)
+        {
+            ctx->controller.StartCancel();
+
+            // an item finishing as it is cancelled may end the batch, so a copy is walked
+            for (auto& item : std::vector(ctx->batch))
+                 item->controller.StartCancel();
         }
 
-        void do_write(Message* msg)
+        // gives back the slots of a call whose handler is not done, once its connection is gone it may never be
+        void release(context_t& ctx)
         {
+            for (auto l : std::exchange(ctx->limiters, {}))
+            {
+                 if (l)
+                     l->release();
+            }
+
+            for (auto& item : ctx->batch)
+                 release(item);
+        }
+
+        bool admit(context_t& ctx, const std::string& name)
+        {
+            if (auto n = server.connection_limit(); n && calls.size() >= n)
+                return false;
+
+            return server.acquire(ctx, name);
+        }
+
+        void on_cancel(uint64_t id)
+        {
+            if (auto it = calls.find(id); it != calls.end())
+                cancel(it->second);
+        }
+
+        void on_done(context_t ctx)
+        {
+            auto parent = std::move(ctx->parent);
+
+            if (!parent)
+                calls.erase(ctx->id);
+
+            auto rtt = steady_t::now() - ctx->start;
+
+            for (auto l : std::exchange(ctx->limiters, {}))
+            {
+                 if (l)
+                     l->release(rtt);
+            }
+
+            if (ctx->closure)
+                ctx->closure->Run();
+
+            auto& controller = ctx->controller;
+            controller.finish();
+
+            if (parent)
+            {
+                if (controller.IsCanceled())
+                    ctx->set_res(CANCELED, "Call cancelled");
+                else if (controller.Failed())
+                    ctx->set_res(FAILED, controller.ErrorText());
+                else
+                    ctx->set_res(SUCCEED, {});
+
+                if (--parent->left == 0)
+                    on_batch_done(parent);
+
+                return;
+            }
+
+            if (controller.IsCanceled() || !socket.is_open())
+                return;
+
+            ctx->set_res(SUCCEED, {});
+
+            if (controller.Failed())
+                ctx->set_res(FAILED, controller.ErrorText());
+
+            do_write(ctx);
+        }
+
+        void reply(context_t ctx, status status, const std::string& message)
+        {
+            ctx->set_res(status, message);
+
+            do_write(ctx);
+            do_read_header();
+        }
+
+        void do_write(context_t ctx)
+        {
+            if (!ctx->batch.empty())
+                return do_write_batch(ctx);
+
+            auto& res = ctx->res;
+            Message* msg = ctx->Response.get();
+
             size_t rpc_len = sizeof(res.id) + sizeof(status) + sizeof(size_t) + res.message.size();
-            size_t arg_len = msg ? msg->ByteSizeLong() : 0;
+            size_t arg_len = ctx->cached ? ctx->cached->size() : msg ? msg->ByteSizeLong() : 0;
 
-            count = sizeof(header) + rpc_len + arg_len;
+            uint16_t flags = ctx->checksum ? CHECKSUM | VERIFIES : VERIFIES;
+            ctx->count = sizeof(header) + rpc_len + arg_len + trailer(flags);
 
-            if (!allocate(buff, size, count))
+            if (!allocate(ctx->buff, ctx->size, ctx->count))
                 return close();
 
+            auto buff = ctx->buff;
+
             buff->rpc_len = rpc_len;
             buff->arg_len = arg_len;
 
+            buff->type = REPLY;
+            buff->flags = flags;
+
             copy<1>(buff, res, res.message);
 
-            if (msg && !msg->SerializeToArray(buff->data + rpc_len, arg_len))
+            if (ctx->cached)
+                std::memcpy(buff->data + rpc_len, ctx->cached->data(), arg_len);
+            else if (msg && !msg->SerializeToArray(buff->data + rpc_len, arg_len))
                 return close();
 
-            net::async_write(socket, net::buffer(buff, count),
-            [self = shared_this()](error_code_t ec, std::size_t bytes_transferred)
+            if (ctx->cache && res.status == SUCCEED)
+                ctx->cache->put(ctx->hash, std::move(ctx->key), std::string(buff->data + rpc_len, arg_len));
+
+            if (flags & CHECKSUM)
+                seal(buff);
+
+            queue.push_back(ctx);
+
+            if (queue.size() == 1)
+                do_send();
+        }
+
+        // each item carries its status, message and response bytes
+        void do_write_batch(context_t ctx)
+        {
+            auto& res = ctx->res;
+            size_t rpc_len = sizeof(res.id) + sizeof(status) + sizeof(size_t) + res.message.size();
+
+            std::vector<uint32_t> sizes;
+            sizes.reserve(ctx->batch.size());
+
+            size_t arg_len = 0;
+
+            for (auto& item : ctx->batch)
+            {
+                 auto msg = item->Response.get();
+                 sizes.push_back(msg && item->res.status == SUCCEED ? msg->ByteSizeLong() : 0);
+
+                 arg_len += 3 * sizeof(uint32_t) + item->res.message.size() + sizes.back();
+            }
+
+            uint16_t flags = ctx->checksum ? CHECKSUM | VERIFIES : VERIFIES;
+            ctx->count = sizeof(header) + rpc_len + arg_len + trailer(flags);
+
+            if (!allocate(ctx->buff, ctx->size, ctx->count))
+                return close();
+
+            auto buff = ctx->buff;
+
+            buff->rpc_len = rpc_len;
+            buff->arg_len = arg_len;
+
+            buff->type = BATCH;
+            buff->flags = flags;
+
+            copy<1>(buff, res, res.message);
+            char* p = buff->data + rpc_len;
+
+            for (size_t i = 0; i < sizes.size(); ++i)
             {
-                self->on_write(ec, bytes_transferred); 
-            });
+                 auto& item = ctx->batch[i];
+
+                 uint32_t status = item->res.status;
+                 uint32_t len = item->res.message.size();
+
+                 p = put(p, &status, sizeof(status));
+                 p = put(p, &len, sizeof(len));
+
+                 p = put(p, item->res.message.data(), len);
+                 p = put(p, &sizes[i], sizeof(uint32_t));
+
+                 if (sizes[i] && !item->Response->SerializeToArray(p, sizes[i]))
+                     return close();
+
+                 p += sizes[i];
+            }
+
+            ctx->batch.clear();
+
+            if (flags & CHECKSUM)
+                seal(buff);
+
+            queue.push_back(ctx);
+
+            if (queue.size() == 1)
+                do_send();
+        }
+
+        // heartbeat and goaway frames are just a header
+        void notify(uint16_t type)
+        {
+            auto ctx = std::make_shared<context<session<T>>>(nullptr, 0);
+            ctx->count = sizeof(header);
+
+            if (!allocate(ctx->buff, ctx->size, ctx->count))
+                return close();
+
+            auto buff = ctx->buff;
+
+            buff->rpc_len = 0;
+            buff->arg_len = 0;
+
+            buff->type = type;
+            buff->flags = VERIFIES;
+
+            queue.push_back(ctx);
+
+            if (queue.size() == 1)
+                do_send();
+        }
+
+        // the client sends nothing new on this connection, finishes what it has in flight and closes it
+        void goaway()
+        {
+            if (going || !socket.is_open())
+                return;
+
+            going = true;
+
+            if (ready)
+                notify(GOAWAY);
+        }
+
+        // nothing in flight and nothing heard from the peer for the limit
+        bool idle(time_point_t now, std::chrono::milliseconds limit) const
+        {
+            return calls.empty() && queue.empty() && now - arrival >= limit;
+        }
+
+        void do_send()
+        {
+            auto ctx = queue.front();
+
+            socket.async_write(ctx->buff, ctx->count,
+            server.monitor().wrap("session::on_write",
+            [ctx, self = shared_this()](error_code_t ec, std::size_t bytes_transferred)
+            {
+                self->on_write(ec, bytes_transferred);
+            }), ctx);
         }
 
         void on_write(error_code_t ec, std::size_t bytes_transferred)
         {
-            if (!ec)
-                do_read_header();
-            else
-                close();
+            if (ec)
+                return close();
+
+            socket.reap();
+
+            if (queue.empty())
+                return;
+
+            queue.pop_front();
+
+            if (!queue.empty())
+                do_send();
         }
 
         ~session()
@@ -207,14 +754,20 @@ namespace urpc
     private:
         T& server;
 
-        socket_t socket;
+        stream socket;
         header* buff = nullptr;
 
         request req;
-        response res;
+        time_point_t arrival = steady_t::now();
+
+        calls_t calls;
+        queue_t queue;
 
         uint32_t size = 0;
         uint32_t count = 0;
+
+        bool ready = false;
+        bool going = false;
     };
 
     class server
@@ -226,13 +779,35 @@ namespace urpc
         using connection_t = std::shared_ptr<session<server>>;
         using connections_t = std::unordered_map<uint64_t, connection_t>;
 
+        using context_t = std::shared_ptr<context<session<server>>>;
+        using priorities_t = std::unordered_map<std::string, uint32_t>;
+
+        using limiters_t = std::unordered_map<std::string, limiter>;
+        using caches_t = std::unordered_map<std::string, response_cache>;
+
+        struct handler
+        {
+            skeleton* s;
+            uint32_t id;
+
+            Closure* closure;
+        };
+
+        using methods_t = std::unordered_map<std::string, handler>;
+
         server(net::io_uring_context& ioc, const std::string& port) :
-        ioc(ioc), acceptor(ioc, tcp::endpoint(tcp::v4(), std::stoi(port)))
+        ioc(ioc), acceptor(ioc, port), monitor_(loop_monitor::of(ioc)), timer(ioc)
         {
         }
 
         server(net::io_uring_context& ioc, const std::string& host, const std::string& port) :
-        ioc(ioc), acceptor(ioc, tcp::endpoint(net::ip::make_address(host), std::stoi(port)))
+        ioc(ioc), acceptor(ioc, host, port), monitor_(loop_monitor::of(ioc)), timer(ioc)
+        {
+        }
+
+        // serves on a listener set up elsewhere, e.g. server(ioc, urpc::adopt(ioc, urpc::inherit(path)))
+        server(net::io_uring_context& ioc, listener acceptor) :
+        ioc(ioc), acceptor(std::move(acceptor)), monitor_(loop_monitor::of(ioc)), timer(ioc)
         {
         }
 
@@ -243,12 +818,117 @@ namespace urpc
 
         void stop()
         {
+            beat.reset();
+            accepting = false;
+
             acceptor.close();
 
-            for (auto& [_, s] : connections)
+            for (auto& [_, s] : std::exchange(connections, {}))
                  s->close();
+        }
+
+        // stops accepting and sends every client a goaway, sessions end as their clients leave; those still
+        // open after timeout milliseconds are closed, done runs once the last one is gone
+        void drain(uint32_t timeout, std::function<void()> done = {})
+        {
+            accepting = false;
+            draining = true;
 
-            connections.clear();
+            drained = std::move(done);
+            acceptor.close();
+
+            if (handover)
+                handover->close();
+
+            for (auto& [_, s] : connections)
+                 s->goaway();
+
+            if (connections.empty())
+                return finish();
+
+            if (!timeout)
+                return;
+
+            timer.expires_from_now(std::chrono::milliseconds(timeout));
+
+            timer.async_wait(monitor_->wrap("server::on_drain",
+            [this](error_code_t ec)
+            {
+                if (ec)
+                    return;
+
+                std::vector<connection_t> left;
+
+                for (auto& [_, s] : connections)
+                     left.push_back(s);
+
+                for (auto& s : left)
+                     s->close();
+            }));
+        }
+
+        void finish()
+        {
+            if (!draining)
+                return;
+
+            draining = false;
+
+            timer.cancel();
+            beat.reset();
+
+            if (auto done = std::move(drained); done)
+                done();
+        }
+
+        // offers the listening socket to the next process, which picks it up with urpc::inherit(path);
+        // once handed over this server drains as with drain(timeout, done)
+        // only the user of this process can connect to a path, others are turned away by their credentials
+        void handoff(const std::string& path, uint32_t timeout, std::function<void()> done = {})
+        {
+            handover_path = path;
+
+            if (!handover_path.empty() && handover_path[0] == '@')
+                handover_path[0] = '\0';
+            else
+                unlink_stale(handover_path);
+
+            handover.emplace(ioc, local::endpoint(handover_path));
+
+            if (handover_path[0] != '\0')
+                ::chmod(handover_path.c_str(), S_IRUSR | S_IWUSR);
+
+            do_handoff(timeout, std::move(done));
+        }
+
+        void do_handoff(uint32_t timeout, std::function<void()> done)
+        {
+            handover->async_accept(monitor_->wrap("server::on_handoff",
+            [this, timeout, done = std::move(done)](error_code_t ec, local::socket socket) mutable
+            {
+                on_handoff(ec, socket, timeout, std::move(done));
+            }));
+        }
+
+        void on_handoff(error_code_t ec, local::socket& socket, uint32_t timeout, std::function<void()> done)
+        {
+            if (ec || !accepting)
+                return;
+
+            if (!trusted(socket.native_handle()))
+            {
+                socket.close();
+
+                return do_handoff(timeout, std::move(done));
+            }
+
+            if (!send_fd(socket.native_handle(), acceptor.native_handle(), acceptor.uses_shm() ? 's' : 0))
+                return do_handoff(timeout, std::move(done));
+
+            if (handover_path[0] != '\0')
+                ::unlink(handover_path.c_str());
+
+            drain(timeout, std::move(done));
         }
 
         services_t& services()
@@ -256,43 +936,285 @@ namespace urpc
             return services_;
         }
 
+        methods_t& methods()
+        {
+            return methods_;
+        }
+
+        loop_monitor& monitor()
+        {
+            return *monitor_;
+        }
+
+        net::io_uring_context& ring()
+        {
+            return ioc;
+        }
+
         void remove(uint64_t n)
         {
             connections.erase(n);
+
+            if (draining && connections.empty())
+                finish();
+        }
+
+        // calls in flight point at the limiters, so a limit set again is updated in place
+        void limit(const limiter_options& options)
+        {
+            if (limiter_)
+                limiter_->configure(options);
+            else
+                limiter_.emplace(options);
+        }
+
+        void limit(const std::string& method, const limiter_options& options)
+        {
+            if (auto it = limiters.find(method); it != limiters.end())
+                it->second.configure(options);
+            else
+                limiters.try_emplace(method, options);
+        }
+
+        void tls(const tls_options& options)
+        {
+            tls_.emplace(options, true);
+        }
+
+        void transport(const transport_options& options)
+        {
+            transport_ = options;
+        }
+
+        // opt in for methods whose response depends on nothing but the request
+        void cache(const std::string& method, const cache_options& options)
+        {
+            caches.insert_or_assign(method, response_cache(options));
+        }
+
+        // sessions silent for options.idle with nothing in flight are closed, live clients keep theirs with pings
+        void keepalive(const keepalive_options& options)
+        {
+            keepalive_ = options;
+
+            beat.reset();
+            beat.emplace(ioc, options.interval, [this](time_point_t now){ sweep(now); });
+        }
+
+        void sweep(time_point_t now)
+        {
+            if (!keepalive_.idle)
+                return;
+
+            std::vector<connection_t> idle;
+            auto limit = std::chrono::milliseconds(keepalive_.idle);
+
+            for (auto& [_, s] : connections)
+            {
+                 if (s->idle(now, limit))
+                     idle.push_back(s);
+            }
+
+            for (auto& s : idle)
+                 s->close();
+        }
+
+        response_cache* cached(const std::string& method)
+        {
+            if (caches.empty())
+                return nullptr;
+
+            auto it = caches.find(method);
+
+            return it != caches.end() ? &it->second : nullptr;
+        }
+
+        // handlers run at most options.concurrency at a time, waiting calls are ordered by class and connection
+        // reconfigured in place, calls already waiting keep their place
+        void schedule(const scheduler_options& options)
+        {
+            if (scheduler_)
+            {
+                scheduler_->configure(options);
+                pump();
+            }
+            else
+                scheduler_.emplace(options);
+        }
+
+        // class of a method, 0 being the most latency sensitive, methods not set are in class 0
+        void priority(const std::string& method, uint32_t cls)
+        {
+            priorities.insert_or_assign(method, cls);
+        }
+
+        uint32_t priority(const std::string& method) const
+        {
+            if (priorities.empty())
+                return 0;
+
+            auto it = priorities.find(method);
+
+            return it != priorities.end() ? it->second : 0;
+        }
+
+        size_t queued() const
+        {
+            return scheduler_ ? scheduler_->size() : 0;
+        }
+
+        void submit(context_t& ctx, const std::string& name, uint64_t flow, uint32_t cost)
+        {
+            if (!scheduler_)
+                return ctx->session->dispatch(ctx);
+
+            scheduler_->push(priority(name), flow, ctx, cost);
+            pump();
+        }
+
+        std::vector<context_t> withdraw(uint64_t flow)
+        {
+            return scheduler_ ? scheduler_->drop(flow) : std::vector<context_t>();
+        }
+
+        void pump()
+        {
+            if (pumping)
+                return;
+
+            pumping = true;
+
+            while (running < scheduler_->config().concurrency && !scheduler_->empty())
+            {
+                auto ctx = scheduler_->pop();
+
+                ++running;
+                ctx->scheduled = true;
+
+                ctx->session->dispatch(ctx);
+            }
+
+            pumping = false;
+        }
+
+        void finished()
+        {
+            if (running)
+                --running;
+
+            pump();
+        }
+
+        void connection_limit(uint32_t n)
+        {
+            connection_limit_ = n;
+        }
+
+        uint32_t connection_limit() const
+        {
+            return connection_limit_;
+        }
+
+        const std::optional<limiter>& concurrency() const
+        {
+            return limiter_;
+        }
+
+        template <typename C>
+        bool acquire(C& ctx, const std::string& name)
+        {
+            if (limiter_ && !limiter_->acquire())
+                return false;
+
+            if (auto it = limiters.find(name); it != limiters.end())
+            {
+                if (!it->second.acquire())
+                {
+                    if (limiter_)
+                        limiter_->release();
+
+                    return false;
+                }
+
+                ctx->limiters[1] = &it->second;
+            }
+
+            if (limiter_)
+                ctx->limiters[0] = &*limiter_;
+
+            ctx->start = steady_t::now();
+
+            return true;
         }
 
         bool register_service(Service* service, Closure* closure)
         {
-            std::string key = service->GetDescriptor()->name();
+            auto descriptor = service->GetDescriptor();
+            std::string key = descriptor->name();
 
             if (services_.contains(key))
                 return false;
 
+            // a skeleton answering to one of its methods would take its calls
+            for (int i = 0; i < descriptor->method_count(); ++i)
+            {
+                 if (methods_.contains(key + "." + descriptor->method(i)->name()))
+                     return false;
+            }
+
             services_.try_emplace(key, std::make_pair(service, closure));
 
             return true;
         }
 
+        // generated skeletons are looked up by the full wire name of each method
+        bool register_service(skeleton* service, Closure* closure)
+        {
+            if (services_.contains(service->GetDescriptor()->name()))
+                return false;
+
+            for (uint32_t id = 0; id < service->methods(); ++id)
+            {
+                 if (methods_.contains(service->method(id)))
+                     return false;
+            }
+
+            for (uint32_t id = 0; id < service->methods(); ++id)
+                 methods_.try_emplace(service->method(id), handler { service, id, closure });
+
+            return true;
+        }
+
         void do_accept()
         {
-            acceptor.async_accept(
-            [this](error_code_t ec, socket_t socket)
+            acceptor.async_accept(monitor_->wrap("server::on_accept",
+            [this](error_code_t ec, stream socket)
             {
                 on_accept(ec, std::move(socket));
-            });
+            }));
         }
 
-        void on_accept(error_code_t ec, socket_t socket)
+        void on_accept(error_code_t ec, stream socket)
         {
             if (!ec)
             {
+                bool secure = tls_ && !socket.is_local();
+                socket.apply(transport_);
+
                 auto s = std::make_shared<session<server>>(*this, std::move(socket));
                 connections.try_emplace(uint64_t(s.get()), s);
 
-                s->run();
+                if (secure)
+                    s->handshake(ioc, *tls_);
+                else
+                    s->run();
+
+                if (draining)
+                    s->goaway();
             }
 
-            do_accept();
+            if (accepting)
+                do_accept();
         }
 
         ~server()
@@ -301,10 +1223,41 @@ namespace urpc
 
     private:
         net::io_uring_context& ioc;
-        tcp::acceptor acceptor;
+        listener acceptor;
 
+        std::shared_ptr<loop_monitor> monitor_;
         services_t services_;
+
+        methods_t methods_;
+
+        std::optional<limiter> limiter_;
+        limiters_t limiters;
+
+        caches_t caches;
+
+        uint32_t connection_limit_ = 0;
         connections_t connections;
+
+        std::optional<tls_context> tls_;
+        transport_options transport_;
+
+        keepalive_options keepalive_;
+        std::optional<heartbeat::subscription> beat;
+
+        net::steady_timer timer;
+        std::function<void()> drained;
+
+        std::optional<local::acceptor> handover;
+        std::string handover_path;
+
+        bool accepting = true;
+        bool draining = false;
+
+        std::optional<scheduler<context_t>> scheduler_;
+        priorities_t priorities;
+
+        uint32_t running = 0;
+        bool pumping = false;
     };
 }
 
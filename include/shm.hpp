@@ -0,0 +1,541 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef SHM_HPP
+#define SHM_HPP
+
+#include <atomic>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <controller.hpp>
+
+namespace urpc
+{
+    using local = net::local::stream_protocol;
+
+    // passes fd over a unix socket, the byte that carries it is free for the caller to tag it with
+    inline bool send_fd(int socket, int fd, char tag = 0)
+    {
+        iovec iov { &tag, 1 };
+
+        alignas(cmsghdr) char space[CMSG_SPACE(sizeof(int))] {};
+        msghdr msg {};
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        msg.msg_control = space;
+        msg.msg_controllen = sizeof(space);
+
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+        return ::sendmsg(socket, &msg, MSG_NOSIGNAL) == 1;
+    }
+
+    // -1 with errno set on failure, ECONNRESET once the peer is gone and EPROTO for a byte that carries no fd
+    inline int recv_fd(int socket, char& tag, int flags = 0)
+    {
+        iovec iov { &tag, 1 };
+
+        alignas(cmsghdr) char space[CMSG_SPACE(sizeof(int))] {};
+        msghdr msg {};
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        msg.msg_control = space;
+        msg.msg_controllen = sizeof(space);
+
+        if (auto n = ::recvmsg(socket, &msg, flags | MSG_CMSG_CLOEXEC); n != 1)
+        {
+            if (n == 0)
+                errno = ECONNRESET;
+
+            return -1;
+        }
+
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+
+        if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            errno = EPROTO;
+
+            return -1;
+        }
+
+        int fd;
+        std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+        return fd;
+    }
+
+    // single producer single consumer byte ring living in a shared mapping; the peer can write to all of it, so
+    // the indices are read once, checked against the capacity known at compile time and only then used
+    struct shm_ring
+    {
+        // bytes per direction, a power of two
+        static constexpr uint64_t capacity = 1 << 20;
+
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+
+        // set by a side that parked and wants a doorbell once the other side made progress
+        alignas(64) std::atomic<uint32_t> reader;
+        alignas(64) std::atomic<uint32_t> writer;
+
+        char* data()
+        {
+            return reinterpret_cast<char*>(this + 1);
+        }
+
+        bool readable() const
+        {
+            return tail.load(std::memory_order_acquire) != head.load(std::memory_order_relaxed);
+        }
+
+        bool writable() const
+        {
+            return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) < capacity;
+        }
+
+        // the bytes copied, -EPROTO once the indices are not those of a ring of capacity bytes
+        int64_t produce(const char* src, size_t n)
+        {
+            auto t = tail.load(std::memory_order_relaxed);
+            auto h = head.load(std::memory_order_acquire);
+
+            if (h > t || t - h > capacity)
+                return -EPROTO;
+
+            n = std::min<uint64_t>(n, capacity - (t - h));
+
+            auto off = t & (capacity - 1);
+            auto first = std::min<uint64_t>(n, capacity - off);
+
+            std::memcpy(data() + off, src, first);
+            std::memcpy(data(), src + first, n - first);
+
+            tail.store(t + n, std::memory_order_release);
+
+            return n;
+        }
+
+        int64_t consume(char* dst, size_t n)
+        {
+            auto h = head.load(std::memory_order_relaxed);
+            auto t = tail.load(std::memory_order_acquire);
+
+            if (h > t || t - h > capacity)
+                return -EPROTO;
+
+            n = std::min<uint64_t>(n, t - h);
+
+            auto off = h & (capacity - 1);
+            auto first = std::min<uint64_t>(n, capacity - off);
+
+            std::memcpy(dst, data() + off, first);
+            std::memcpy(dst + first, data(), n - first);
+
+            head.store(h + n, std::memory_order_release);
+
+            return n;
+        }
+    };
+
+    class shm_link : public std::enable_shared_from_this<shm_link>
+    {
+    public:
+        using handler_t = std::function<void(error_code_t, std::size_t)>;
+        using connect_t = std::function<void(error_code_t, int)>;
+
+        struct op
+        {
+            char* data = nullptr;
+
+            size_t size = 0;
+            size_t done = 0;
+
+            handler_t handler;
+        };
+
+        static constexpr size_t capacity = shm_ring::capacity;
+
+        shm_link(net::io_uring_context& ioc) : control(ioc), timer(ioc), rd_timer(ioc), wr_timer(ioc)
+        {
+        }
+
+        shm_link(net::io_uring_context& ioc, local::socket socket) : control(std::move(socket)), timer(ioc), rd_timer(ioc), wr_timer(ioc)
+        {
+        }
+
+        static error_code_t last_error()
+        {
+            return error_code_t(errno, std::system_category());
+        }
+
+        size_t length() const
+        {
+            return 2 * (sizeof(shm_ring) + capacity);
+        }
+
+        void map(void* base, bool server)
+        {
+            this->base = base;
+
+            auto c2s = static_cast<shm_ring*>(base);
+            auto s2c = reinterpret_cast<shm_ring*>(c2s->data() + capacity);
+
+            rx = server ? c2s : s2c;
+            tx = server ? s2c : c2s;
+        }
+
+        // server side: create the mapping and hand it to the peer over the control socket
+        error_code_t offer()
+        {
+            int fd = ::memfd_create("urpc", MFD_CLOEXEC);
+
+            if (fd == -1)
+                return last_error();
+
+            error_code_t ec;
+            void* p = MAP_FAILED;
+
+            if (::ftruncate(fd, length()) == -1 || (p = ::mmap(nullptr, length(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+                ec = last_error();
+            else
+            {
+                auto c2s = new (p) shm_ring { {0}, {0}, {0}, {0} };
+                new (c2s->data() + capacity) shm_ring { {0}, {0}, {0}, {0} };
+
+                map(p, true);
+
+                if (!urpc::send_fd(control.native_handle(), fd))
+                    ec = last_error();
+            }
+
+            ::close(fd);
+
+            return ec;
+        }
+
+        // client side: connect the control socket and wait for the mapping the server offers
+        void async_connect(const std::string& path, connect_t handler)
+        {
+            net::async_connect(control, local::endpoint(path),
+            [self = shared_from_this(), handler = std::move(handler)](error_code_t ec, int fd) mutable
+            {
+                if (ec)
+                    return handler(ec, fd);
+
+                self->accept(std::move(handler), 0);
+            });
+        }
+
+        // the offer normally arrives right after the connect completes, so poll it with a short timer
+        void accept(connect_t handler, uint32_t round)
+        {
+            char tag;
+            int fd = recv_fd(control.native_handle(), tag, MSG_DONTWAIT);
+
+            if (fd == -1)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    return handler(last_error(), -1);
+
+                if (round == 100)
+                    return handler(std::make_error_code(std::errc::timed_out), -1);
+
+                timer.expires_from_now(std::chrono::microseconds(20 << std::min(round, 9u)));
+
+                return timer.async_wait(
+                [self = shared_from_this(), handler = std::move(handler), round](error_code_t ec) mutable
+                {
+                    if (ec)
+                        return handler(ec, -1);
+
+                    self->accept(std::move(handler), round + 1);
+                });
+            }
+
+            // a shorter mapping would fault past its end
+            error_code_t ec;
+            void* p = MAP_FAILED;
+
+            if (struct stat st; ::fstat(fd, &st) == -1)
+                ec = last_error();
+            else if (size_t(st.st_size) < length())
+                ec = std::make_error_code(std::errc::protocol_error);
+            else if (p = ::mmap(nullptr, length(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); p == MAP_FAILED)
+                ec = last_error();
+            else
+                map(p, false);
+
+            ::close(fd);
+            handler(ec, control.native_handle());
+        }
+
+        void async_read(void* data, size_t size, handler_t handler)
+        {
+            rd = op { static_cast<char*>(data), size, 0, std::move(handler) };
+            pump_read();
+        }
+
+        void async_write(const void* data, size_t size, handler_t handler)
+        {
+            wr = op { static_cast<char*>(const_cast<void*>(data)), size, 0, std::move(handler) };
+            pump_write();
+        }
+
+        void pump_read()
+        {
+            while (rd.handler)
+            {
+                auto n = rx->consume(rd.data + rd.done, rd.size - rd.done);
+
+                if (n < 0)
+                    return fail();
+
+                rd.done += n;
+
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (n && rx->writer.exchange(0))
+                    ring();
+
+                if (rd.done == rd.size)
+                    return complete(rd, {});
+
+                rx->reader.store(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (!rx->readable())
+                    return arm();
+
+                rx->reader.store(0);
+            }
+        }
+
+        void pump_write()
+        {
+            while (wr.handler)
+            {
+                auto n = tx->produce(wr.data + wr.done, wr.size - wr.done);
+
+                if (n < 0)
+                    return fail();
+
+                wr.done += n;
+
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (n && tx->reader.exchange(0))
+                    ring();
+
+                if (wr.done == wr.size)
+                    return complete(wr, {});
+
+                tx->writer.store(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (!tx->writable())
+                    return arm();
+
+                tx->writer.store(0);
+            }
+        }
+
+        // completions go through the ring as those of a socket do, with frames already buffered a handler that
+        // starts the next operation would otherwise find it completed on its own stack, and recurse without end
+        void complete(op& o, error_code_t ec)
+        {
+            auto& t = &o == &rd ? rd_timer : wr_timer;
+            t.expires_from_now(std::chrono::nanoseconds(0));
+
+            t.async_wait(
+            [self = shared_from_this(), handler = std::move(o.handler), ec, n = o.done](error_code_t) mutable
+            {
+                handler(ec, n);
+            });
+
+            o.handler = nullptr;
+        }
+
+        // the peer broke the ring, both operations fail and the link goes down, so the session closes
+        void fail()
+        {
+            auto ec = std::make_error_code(std::errc::protocol_error);
+
+            if (rd.handler)
+                complete(rd, ec);
+
+            if (wr.handler)
+                complete(wr, ec);
+
+            shutdown();
+            close();
+        }
+
+        // wake the peer, which only listens for this byte while it is parked
+        void ring()
+        {
+            char byte = 0;
+            ::send(control.native_handle(), &byte, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+
+        void arm()
+        {
+            if (armed)
+                return;
+
+            armed = true;
+
+            net::async_read(control, net::buffer(&bell, 1),
+            [self = shared_from_this()](error_code_t ec, std::size_t)
+            {
+                self->on_bell(ec);
+            });
+        }
+
+        void on_bell(error_code_t ec)
+        {
+            armed = false;
+
+            if (ec)
+            {
+                if (rd.handler)
+                    complete(rd, ec);
+
+                if (wr.handler)
+                    complete(wr, ec);
+
+                return;
+            }
+
+            pump_write();
+            pump_read();
+        }
+
+        bool is_open() const
+        {
+            return control.is_open();
+        }
+
+        int native_handle()
+        {
+            return control.native_handle();
+        }
+
+        void shutdown()
+        {
+            control.shutdown(local::socket::shutdown_both);
+        }
+
+        void close()
+        {
+            control.close();
+        }
+
+        ~shm_link()
+        {
+            if (base)
+                ::munmap(base, length());
+        }
+
+    private:
+        local::socket control;
+        net::steady_timer timer;
+
+        net::steady_timer rd_timer;
+        net::steady_timer wr_timer;
+
+        void* base = nullptr;
+
+        shm_ring* rx = nullptr;
+        shm_ring* tx = nullptr;
+
+        op rd;
+        op wr;
+
+        char bell;
+        bool armed = false;
+    };
+
+    class shm_stream
+    {
+    public:
+        enum shutdown_type
+        {
+            shutdown_both
+        };
+
+        shm_stream(net::io_uring_context& ioc) : link(std::make_shared<shm_link>(ioc))
+        {
+        }
+
+        shm_stream(net::io_uring_context& ioc, local::socket socket) : link(std::make_shared<shm_link>(ioc, std::move(socket)))
+        {
+        }
+
+        error_code_t offer()
+        {
+            return link->offer();
+        }
+
+        bool is_open() const
+        {
+            return link->is_open();
+        }
+
+        int native_handle()
+        {
+            return link->native_handle();
+        }
+
+        void shutdown(shutdown_type)
+        {
+            link->shutdown();
+        }
+
+        void close()
+        {
+            link->close();
+        }
+
+        template <typename H>
+        void async_connect(const std::string& path, H&& handler)
+        {
+            link->async_connect(path, std::forward<H>(handler));
+        }
+
+        template <typename H>
+        void async_read(void* data, size_t size, H&& handler)
+        {
+            link->async_read(data, size, std::forward<H>(handler));
+        }
+
+        template <typename H>
+        void async_write(const void* data, size_t size, H&& handler)
+        {
+            link->async_write(data, size, std::forward<H>(handler));
+        }
+
+    private:
+        std::shared_ptr<shm_link> link;
+    };
+}
+
+#endif
@@ -0,0 +1,38 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef SKELETON_HPP
+#define SKELETON_HPP
+
+#include <controller.hpp>
+
+namespace urpc
+{
+    // base of the server skeletons emitted by protoc-gen-urpc, methods are addressed by their
+    // compile-time id and dispatched with a switch instead of descriptor lookups and down casts
+    class skeleton
+    {
+    public:
+        virtual const ServiceDescriptor* GetDescriptor() = 0;
+
+        virtual uint32_t methods() const = 0;
+        virtual const std::string& method(uint32_t id) const = 0;
+
+        virtual Message* make_request(uint32_t id) const = 0;
+        virtual Message* make_response(uint32_t id) const = 0;
+
+        virtual void dispatch(uint32_t id, RpcController* controller, const Message* request, Message* response, Closure* done) = 0;
+
+        virtual ~skeleton()
+        {
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,385 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef TLS_HPP
+#define TLS_HPP
+
+#include <stdexcept>
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/hmac.h>
+#include <transport.hpp>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+namespace urpc
+{
+    struct tls_options
+    {
+        // PEM files, a server needs both, a client only when the server asks for a certificate
+        std::string certificate;
+        std::string key;
+
+        // trusted CA bundle; a client falls back to the system store without it, a server asks clients for a
+        // certificate only when it is set
+        std::string ca;
+
+        // a client skips checking the server only when this is cleared on purpose, e.g. against a test server
+        bool verify = true;
+
+        // name sent as SNI and checked against the server certificate
+        std::string server_name;
+
+        // milliseconds allowed for the handshake
+        uint32_t timeout = 5000;
+    };
+
+    // TLS 1.3 with AES-GCM only, the suites the kernel can take over once the handshake is done
+    class tls_context
+    {
+    public:
+        tls_context(const tls_options& options, bool server) : options(options), server(server)
+        {
+            ctx = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+
+            if (!ctx)
+                throw std::runtime_error("SSL_CTX_new failed");
+
+            SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+            SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384");
+
+            // a ticket would be the first record under the traffic keys and desync the kernel's sequence
+            SSL_CTX_set_num_tickets(ctx, 0);
+            SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+
+            SSL_CTX_set_keylog_callback(ctx, on_keylog);
+
+            if (!options.certificate.empty() && SSL_CTX_use_certificate_chain_file(ctx, options.certificate.c_str()) != 1)
+                fail("certificate");
+
+            if (!options.key.empty() && SSL_CTX_use_PrivateKey_file(ctx, options.key.c_str(), SSL_FILETYPE_PEM) != 1)
+                fail("key");
+
+            if (!options.ca.empty())
+            {
+                if (SSL_CTX_load_verify_locations(ctx, options.ca.c_str(), nullptr) != 1)
+                    fail("ca");
+
+                SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+            }
+            else if (!server && options.verify)
+            {
+                if (SSL_CTX_set_default_verify_paths(ctx) != 1)
+                    fail("default verify paths");
+
+                SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+            }
+        }
+
+        tls_context(const tls_context&) = delete;
+        tls_context& operator=(const tls_context&) = delete;
+
+        void fail(const std::string& what)
+        {
+            SSL_CTX_free(ctx);
+            throw std::runtime_error("tls " + what + ": " + ERR_error_string(ERR_get_error(), nullptr));
+        }
+
+        static int index()
+        {
+            static int n = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+
+            return n;
+        }
+
+        // the traffic secrets are only exposed through the key log
+        static void on_keylog(const SSL* ssl, const char* line)
+        {
+            auto secrets = static_cast<std::array<std::string, 2>*>(SSL_get_ex_data(ssl, index()));
+
+            if (!secrets)
+                return;
+
+            std::string_view view(line);
+
+            auto label = view.substr(0, view.find(' '));
+            auto hex = view.substr(view.rfind(' ') + 1);
+
+            std::string secret;
+
+            for (size_t i = 0; i + 1 < hex.size(); i += 2)
+                 secret.push_back(char(std::stoi(std::string(hex.substr(i, 2)), nullptr, 16)));
+
+            if (label == "CLIENT_TRAFFIC_SECRET_0")
+                (*secrets)[0] = std::move(secret);
+            else if (label == "SERVER_TRAFFIC_SECRET_0")
+                (*secrets)[1] = std::move(secret);
+        }
+
+        SSL_CTX* native_handle()
+        {
+            return ctx;
+        }
+
+        bool is_server() const
+        {
+            return server;
+        }
+
+        const tls_options& config() const
+        {
+            return options;
+        }
+
+        ~tls_context()
+        {
+            SSL_CTX_free(ctx);
+        }
+
+    private:
+        SSL_CTX* ctx;
+        tls_options options;
+
+        bool server;
+    };
+
+    // runs the handshake over memory BIOs with the stream's own reads and writes, then hands the
+    // traffic keys to kTLS so the connection carries plaintext buffers from then on
+    class tls_handshake : public std::enable_shared_from_this<tls_handshake>
+    {
+    public:
+        using handler_t = std::function<void(error_code_t)>;
+
+        // largest TLS 1.3 ciphertext record
+        static constexpr size_t record = 5 + (1 << 14) + 256;
+
+        tls_handshake(net::io_uring_context& ioc, tls_context& context, stream& socket, handler_t handler) :
+        context(context), socket(socket), timer(ioc), handler(std::move(handler))
+        {
+            ssl = SSL_new(context.native_handle());
+
+            auto rbio = BIO_new(BIO_s_mem());
+            auto wbio = BIO_new(BIO_s_mem());
+
+            SSL_set_bio(ssl, rbio, wbio);
+            SSL_set_ex_data(ssl, tls_context::index(), &secrets);
+
+            if (context.is_server())
+                SSL_set_accept_state(ssl);
+            else
+            {
+                SSL_set_connect_state(ssl);
+
+                if (auto& name = context.config().server_name; !name.empty())
+                {
+                    SSL_set_tlsext_host_name(ssl, name.c_str());
+                    SSL_set1_host(ssl, name.c_str());
+                }
+            }
+        }
+
+        void run()
+        {
+            if (auto n = context.config().timeout; n)
+            {
+                timer.expires_from_now(std::chrono::milliseconds(n));
+
+                timer.async_wait([self = shared_from_this()](error_code_t ec)
+                {
+                    if (!ec && !self->finished)
+                        self->socket.close();
+                });
+            }
+
+            step();
+        }
+
+        void step()
+        {
+            int r = SSL_do_handshake(ssl);
+
+            if (auto n = BIO_ctrl_pending(SSL_get_wbio(ssl)); n)
+            {
+                out.resize(n);
+                BIO_read(SSL_get_wbio(ssl), out.data(), n);
+
+                return socket.async_write(out.data(), out.size(),
+                [self = shared_from_this(), r](error_code_t ec, std::size_t bytes_transferred)
+                {
+                    if (ec)
+                        return self->finish(ec);
+
+                    self->proceed(r);
+                });
+            }
+
+            proceed(r);
+        }
+
+        void proceed(int r)
+        {
+            if (r == 1)
+                return finish(install());
+
+            if (SSL_get_error(ssl, r) != SSL_ERROR_WANT_READ)
+                return finish(std::make_error_code(std::errc::protocol_error));
+
+            do_read_header();
+        }
+
+        // one record at a time, so nothing that follows the handshake is pulled into the BIO
+        void do_read_header()
+        {
+            in.resize(5);
+
+            socket.async_read(in.data(), in.size(),
+            [self = shared_from_this()](error_code_t ec, std::size_t bytes_transferred)
+            {
+                self->on_read_header(ec);
+            });
+        }
+
+        void on_read_header(error_code_t ec)
+        {
+            if (ec)
+                return finish(ec);
+
+            size_t n = uint8_t(in[3]) << 8 | uint8_t(in[4]);
+
+            if (5 + n > record)
+                return finish(std::make_error_code(std::errc::message_size));
+
+            in.resize(5 + n);
+
+            socket.async_read(in.data() + 5, n,
+            [self = shared_from_this()](error_code_t ec, std::size_t bytes_transferred)
+            {
+                if (ec)
+                    return self->finish(ec);
+
+                BIO_write(SSL_get_rbio(self->ssl), self->in.data(), self->in.size());
+                self->step();
+            });
+        }
+
+        // HKDF-Expand-Label with an empty context, the outputs never exceed one hash block
+        static std::string expand(const EVP_MD* md, const std::string& secret, const std::string& label, uint8_t length)
+        {
+            std::string info;
+
+            info.push_back(0);
+            info.push_back(char(length));
+
+            info.push_back(char(6 + label.size()));
+            info.append("tls13 ").append(label);
+
+            info.push_back(0);
+            info.push_back(1);
+
+            unsigned char block[EVP_MAX_MD_SIZE];
+            unsigned int n = 0;
+
+            HMAC(md, secret.data(), secret.size(), reinterpret_cast<const unsigned char*>(info.data()), info.size(), block, &n);
+
+            return std::string(reinterpret_cast<char*>(block), length);
+        }
+
+        template <typename I>
+        static int set(int fd, int direction, const std::string& key, const std::string& iv, uint16_t cipher)
+        {
+            I info {};
+
+            info.info.version = TLS_1_3_VERSION;
+            info.info.cipher_type = cipher;
+
+            std::memcpy(info.key, key.data(), sizeof(info.key));
+            std::memcpy(info.salt, iv.data(), sizeof(info.salt));
+            std::memcpy(info.iv, iv.data() + sizeof(info.salt), sizeof(info.iv));
+
+            return ::setsockopt(fd, SOL_TLS, direction, &info, sizeof(info));
+        }
+
+        error_code_t install()
+        {
+            auto& [client, server] = secrets;
+
+            if (client.empty() || server.empty())
+                return std::make_error_code(std::errc::protocol_error);
+
+            auto id = SSL_CIPHER_get_protocol_id(SSL_get_current_cipher(ssl));
+            bool large = id == 0x1302;
+
+            auto md = large ? EVP_sha384() : EVP_sha256();
+            uint8_t length = large ? 32 : 16;
+
+            int fd = socket.native_handle();
+
+            if (::setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == -1)
+                return error_code_t(errno, std::system_category());
+
+            bool is_server = context.is_server();
+
+            for (auto [direction, secret] : { std::pair(TLS_TX, is_server ? &server : &client), std::pair(TLS_RX, is_server ? &client : &server) })
+            {
+                auto key = expand(md, *secret, "key", length);
+                auto iv = expand(md, *secret, "iv", 12);
+
+                int r = large ? set<tls12_crypto_info_aes_gcm_256>(fd, direction, key, iv, TLS_CIPHER_AES_GCM_256) :
+                                set<tls12_crypto_info_aes_gcm_128>(fd, direction, key, iv, TLS_CIPHER_AES_GCM_128);
+
+                OPENSSL_cleanse(key.data(), key.size());
+
+                if (r == -1)
+                    return error_code_t(errno, std::system_category());
+            }
+
+            return {};
+        }
+
+        void finish(error_code_t ec)
+        {
+            if (finished)
+                return;
+
+            finished = true;
+            timer.cancel();
+
+            OPENSSL_cleanse(secrets[0].data(), secrets[0].size());
+            OPENSSL_cleanse(secrets[1].data(), secrets[1].size());
+
+            handler(ec);
+        }
+
+        ~tls_handshake()
+        {
+            SSL_free(ssl);
+        }
+
+    private:
+        tls_context& context;
+        stream& socket;
+
+        net::steady_timer timer;
+        handler_t handler;
+
+        SSL* ssl;
+        std::array<std::string, 2> secrets;
+
+        std::string in;
+        std::string out;
+
+        bool finished = false;
+    };
+}
+
+#endif
@@ -0,0 +1,406 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <deque>
+#include <variant>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <shm.hpp>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+namespace urpc
+{
+    // endpoints spelled unix:/path/to/socket (or unix:@name for the abstract namespace) select AF_UNIX,
+    // shm:/path/to/socket exchanges frames through shared memory set up over that AF_UNIX socket
+    inline constexpr std::string_view unix_prefix = "unix:";
+    inline constexpr std::string_view shm_prefix = "shm:";
+
+    inline bool is_shm(const std::string& host)
+    {
+        return host.starts_with(shm_prefix);
+    }
+
+    inline bool is_local(const std::string& host)
+    {
+        return host.starts_with(unix_prefix) || is_shm(host);
+    }
+
+    inline std::string local_path(const std::string& host)
+    {
+        std::string path = host.substr(is_shm(host) ? shm_prefix.size() : unix_prefix.size());
+
+        if (!path.empty() && path[0] == '@')
+            path[0] = '\0';
+
+        return path;
+    }
+
+    // a socket file left behind by a process that is gone is removed so the path can be bound again, anything
+    // else, a live server or a file that is no socket, is kept and the bind fails on it
+    inline void unlink_stale(const std::string& path)
+    {
+        struct stat st;
+
+        if (path.empty() || path[0] == '\0' || ::lstat(path.c_str(), &st) == -1 || !S_ISSOCK(st.st_mode))
+            return;
+
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+
+        if (path.size() >= sizeof(addr.sun_path))
+            return;
+
+        std::memcpy(addr.sun_path, path.data(), path.size());
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (fd == -1)
+            return;
+
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 && errno == ECONNREFUSED)
+            ::unlink(path.c_str());
+
+        ::close(fd);
+    }
+
+    // applied to TCP connections only, local and shared memory transports have nothing to tune
+    struct transport_options
+    {
+        bool nodelay = true;
+
+        // the kernel doubles these and caps them at net.core.wmem_max and rmem_max, 0 keeps the defaults
+        int sndbuf = 0;
+        int rcvbuf = 0;
+
+        // microseconds a read may busy poll the device queue, needs CAP_NET_ADMIN above net.core.busy_read
+        int busy_poll = 0;
+
+        // the kernel leaves quickack mode on its own, so it is re-armed once a read brought data in
+        bool quickack = false;
+
+        // replies of at least this many bytes are sent with MSG_ZEROCOPY, 0 disables it; requests are
+        // always copied since a retry patches its frame in place
+        size_t zerocopy = 0;
+    };
+
+    class stream
+    {
+    public:
+        using socket_v = std::variant<tcp::socket, local::socket, shm_stream>;
+
+        // a frame sent with MSG_ZEROCOPY is read by the kernel after the write completes,
+        // its owner is kept until the notification for its send arrives on the error queue
+        using lent_t = std::deque<std::pair<uint32_t, std::shared_ptr<void>>>;
+
+        stream(net::io_uring_context& ioc) : ioc(&ioc), socket(std::in_place_type<tcp::socket>, ioc)
+        {
+        }
+
+        template <typename S>
+        stream(net::io_uring_context& ioc, S&& s) : ioc(&ioc), socket(std::forward<S>(s))
+        {
+        }
+
+        bool is_local() const
+        {
+            return !std::holds_alternative<tcp::socket>(socket);
+        }
+
+        bool is_open() const
+        {
+            return std::visit([](auto& s){ return s.is_open(); }, socket);
+        }
+
+        int native_handle()
+        {
+            return std::visit([](auto& s){ return s.native_handle(); }, socket);
+        }
+
+        void shutdown()
+        {
+            std::visit([](auto& s){ s.shutdown(std::decay_t<decltype(s)>::shutdown_both); }, socket);
+        }
+
+        void close()
+        {
+            std::visit([](auto& s){ s.close(); }, socket);
+            lent.clear();
+        }
+
+        static bool set(int fd, int level, int name, int value)
+        {
+            return ::setsockopt(fd, level, name, &value, sizeof(value)) == 0;
+        }
+
+        // failures are ignored, an option the kernel refuses leaves the connection as it was
+        void apply(const transport_options& options)
+        {
+            if (is_local())
+                return;
+
+            int fd = native_handle();
+
+            set(fd, IPPROTO_TCP, TCP_NODELAY, options.nodelay);
+
+            if (options.sndbuf)
+                set(fd, SOL_SOCKET, SO_SNDBUF, options.sndbuf);
+
+            if (options.rcvbuf)
+                set(fd, SOL_SOCKET, SO_RCVBUF, options.rcvbuf);
+
+            if (options.busy_poll)
+                set(fd, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll);
+
+            if (quickack = options.quickack; quickack)
+                set(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+
+            zerocopy = options.zerocopy && set(fd, SOL_SOCKET, SO_ZEROCOPY, 1) ? options.zerocopy : 0;
+        }
+
+        // drops the owners of every send the kernel reports done, ee_info to ee_data is an inclusive range
+        void reap()
+        {
+            int fd = native_handle();
+
+            while (!lent.empty())
+            {
+                char control[CMSG_SPACE(sizeof(sock_extended_err))];
+                msghdr msg {};
+
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+
+                if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+                    return;
+
+                for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+                {
+                     auto err = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cmsg));
+
+                     if (err->ee_errno || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                         continue;
+
+                     std::erase_if(lent, [lo = err->ee_info, hi = err->ee_data](auto& p){ return p.first - lo <= hi - lo; });
+                }
+            }
+        }
+
+        size_t lending() const
+        {
+            return lent.size();
+        }
+
+        template <typename H>
+        void async_read(void* data, size_t size, H&& handler)
+        {
+            if (quickack)
+            {
+                return read(data, size, [fd = native_handle(), handler = std::forward<H>(handler)](error_code_t ec, size_t n) mutable
+                {
+                    if (!ec && n)
+                        set(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+
+                    handler(ec, n);
+                });
+            }
+
+            read(data, size, std::forward<H>(handler));
+        }
+
+        template <typename H>
+        void read(void* data, size_t size, H&& handler)
+        {
+            std::visit([&]<typename S>(S& s)
+            {
+                if constexpr(std::is_same_v<S, shm_stream>)
+                    s.async_read(data, size, std::forward<H>(handler));
+                else
+                    net::async_read(s, net::buffer(data, size), std::forward<H>(handler));
+            }, socket);
+        }
+
+        // with an owner a large frame goes out zero-copy as far as the socket buffer takes it, the rest is copied
+        template <typename H>
+        void async_write(const void* data, size_t size, H&& handler, std::shared_ptr<void> owner = {})
+        {
+            if (zerocopy && owner && size >= zerocopy)
+                return send_zerocopy(data, size, std::forward<H>(handler), std::move(owner));
+
+            std::visit([&]<typename S>(S& s)
+            {
+                if constexpr(std::is_same_v<S, shm_stream>)
+                    s.async_write(data, size, std::forward<H>(handler));
+                else
+                    net::async_write(s, net::buffer(data, size), std::forward<H>(handler));
+            }, socket);
+        }
+
+        template <typename H>
+        void send_zerocopy(const void* data, size_t size, H&& handler, std::shared_ptr<void> owner)
+        {
+            reap();
+
+            ssize_t n = ::send(native_handle(), data, size, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+
+            if (n >= 0)
+                lent.emplace_back(sent++, std::move(owner));
+            else if (errno == EAGAIN || errno == ENOBUFS || errno == EOPNOTSUPP)
+            {
+                // kTLS takes no MSG_ZEROCOPY, ENOBUFS is the optmem limit for pinned pages
+                if (errno == EOPNOTSUPP)
+                    zerocopy = 0;
+
+                n = 0;
+            }
+            else
+                return handler(error_code_t(errno, std::system_category()), 0);
+
+            if (size_t(n) == size)
+                return handler(error_code_t(), size);
+
+            net::async_write(std::get<tcp::socket>(socket), net::buffer(static_cast<const char*>(data) + n, size - n),
+            [n, handler = std::forward<H>(handler)](error_code_t ec, std::size_t bytes_transferred) mutable
+            {
+                handler(ec, n + bytes_transferred);
+            });
+        }
+
+        template <typename H>
+        void async_connect(const std::string& host, const std::string& port, H&& handler)
+        {
+            zerocopy = 0;
+            quickack = false;
+
+            lent.clear();
+
+            if (is_shm(host))
+            {
+                auto& s = socket.emplace<shm_stream>(*ioc);
+                s.async_connect(local_path(host), std::forward<H>(handler));
+            }
+            else if (urpc::is_local(host))
+            {
+                auto& s = socket.emplace<local::socket>(*ioc);
+                net::async_connect(s, local::endpoint(local_path(host)), std::forward<H>(handler));
+            }
+            else
+            {
+                auto& s = socket.emplace<tcp::socket>(*ioc);
+                net::async_connect(s, tcp::endpoint(net::ip::make_address(host), std::stoi(port)), std::forward<H>(handler));
+            }
+        }
+
+    private:
+        net::io_uring_context* ioc;
+        socket_v socket;
+
+        size_t zerocopy = 0;
+        bool quickack = false;
+
+        uint32_t sent = 0;
+        lent_t lent;
+    };
+
+    class listener
+    {
+    public:
+        using acceptor_v = std::variant<tcp::acceptor, local::acceptor>;
+
+        listener(net::io_uring_context& ioc, const std::string& port) : ioc(ioc), acceptor(make(ioc, {}, port)), shm(is_shm(port))
+        {
+        }
+
+        listener(net::io_uring_context& ioc, const std::string& host, const std::string& port) : ioc(ioc), acceptor(make(ioc, host, port)), shm(is_shm(host))
+        {
+        }
+
+        // takes over an acceptor already bound and listening, see urpc::adopt
+        listener(net::io_uring_context& ioc, acceptor_v acceptor, bool shm) : ioc(ioc), acceptor(std::move(acceptor)), shm(shm)
+        {
+        }
+
+        static acceptor_v make(net::io_uring_context& ioc, const std::string& host, const std::string& port)
+        {
+            auto& name = host.empty() ? port : host;
+
+            if (is_local(name))
+            {
+                auto path = local_path(name);
+                unlink_stale(path);
+
+                return acceptor_v(std::in_place_type<local::acceptor>, ioc, local::endpoint(path));
+            }
+
+            if (host.empty())
+                return acceptor_v(std::in_place_type<tcp::acceptor>, ioc, tcp::endpoint(tcp::v4(), std::stoi(port)));
+
+            return acceptor_v(std::in_place_type<tcp::acceptor>, ioc, tcp::endpoint(net::ip::make_address(host), std::stoi(port)));
+        }
+
+        int native_handle()
+        {
+            return std::visit([](auto& a){ return a.native_handle(); }, acceptor);
+        }
+
+        bool uses_shm() const
+        {
+            return shm;
+        }
+
+        void close()
+        {
+            std::visit([](auto& a){ a.close(); }, acceptor);
+        }
+
+        template <typename H>
+        void async_accept(H&& handler)
+        {
+            std::visit([&](auto& a)
+            {
+                a.async_accept([this, handler = std::forward<H>(handler)]<typename S>(error_code_t ec, S socket) mutable
+                {
+                    if constexpr(std::is_same_v<S, local::socket>)
+                    {
+                        if (shm)
+                        {
+                            shm_stream s(ioc, std::move(socket));
+
+                            if (!ec)
+                                ec = s.offer();
+
+                            return handler(ec, stream(ioc, std::move(s)));
+                        }
+                    }
+
+                    handler(ec, stream(ioc, std::move(socket)));
+                });
+            }, acceptor);
+        }
+
+    private:
+        net::io_uring_context& ioc;
+        acceptor_v acceptor;
+
+        bool shm;
+    };
+}
+
+#endif
@@ -10,7 +10,9 @@
 #ifndef URPC_HPP
 #define URPC_HPP
 
+#include <coro.hpp>
 #include <client.hpp>
 #include <server.hpp>
+#include <loopback.hpp>
 
 #endif
@@ -0,0 +1,273 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+// protoc --plugin=protoc-gen-urpc --urpc_out=. foo.proto emits foo.urpc.h next to foo.pb.h, holding
+// per service a typed stub and a skeleton with compile-time method ids and a switch based dispatcher
+
+#include <cctype>
+#include <memory>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/io/printer.h>
+#include <google/protobuf/compiler/plugin.h>
+#include <google/protobuf/compiler/code_generator.h>
+
+namespace gp = google::protobuf;
+
+class generator : public gp::compiler::CodeGenerator
+{
+public:
+    static std::string replace(std::string s, const std::string& from, const std::string& to)
+    {
+        for (size_t pos = 0; (pos = s.find(from, pos)) != std::string::npos; pos += to.size())
+             s.replace(pos, from.size(), to);
+
+        return s;
+    }
+
+    static std::string base(const std::string& name)
+    {
+        return name.ends_with(".proto") ? name.substr(0, name.size() - 6) : name;
+    }
+
+    static std::string scope(const std::string& package)
+    {
+        return replace(package, ".", "::");
+    }
+
+    // nested messages are flattened with underscores by the C++ generator
+    static std::string type(const gp::Descriptor* d)
+    {
+        auto& package = d->file()->package();
+        auto name = d->full_name().substr(package.empty() ? 0 : package.size() + 1);
+
+        return "::" + (package.empty() ? "" : scope(package) + "::") + replace(name, ".", "_");
+    }
+
+    static std::string guard(const std::string& name)
+    {
+        std::string s = "URPC_" + base(name) + "_URPC_H";
+
+        for (auto& c : s)
+             c = std::isalnum(static_cast<unsigned char>(c)) ? std::toupper(static_cast<unsigned char>(c)) : '_';
+
+        return s;
+    }
+
+    static void service(std::string& out, const gp::ServiceDescriptor* s, const std::string& indent)
+    {
+        auto print = [&](const std::string& line = {})
+        {
+            out += line.empty() ? "\n" : indent + line + "\n";
+        };
+
+        auto name = s->name();
+        int n = s->method_count();
+
+        print("class " + name + "_urpc");
+        print("{");
+        print("public:");
+        print("    enum class id : uint32_t");
+        print("    {");
+
+        for (int i = 0; i < n; ++i)
+             print("        " + s->method(i)->name() + " = " + std::to_string(i) + (i + 1 < n ? "," : ""));
+
+        print("    };");
+        print();
+        print("    static const ::google::protobuf::ServiceDescriptor* descriptor()");
+        print("    {");
+        print("        static auto d = ::google::protobuf::DescriptorPool::generated_pool()->FindServiceByName(\"" + s->full_name() + "\");");
+        print();
+        print("        return d;");
+        print("    }");
+        print();
+        print("    static const ::google::protobuf::MethodDescriptor* method(id i)");
+        print("    {");
+        print("        return descriptor()->method(static_cast<int>(i));");
+        print("    }");
+        print();
+        print("    // the names the server resolves on the wire, service.method");
+        print("    static const std::string& name(id i)");
+        print("    {");
+        print("        static const std::string names[] =");
+        print("        {");
+
+        for (int i = 0; i < n; ++i)
+             print("            \"" + name + "." + s->method(i)->name() + "\"" + (i + 1 < n ? "," : ""));
+
+        print("        };");
+        print();
+        print("        return names[static_cast<uint32_t>(i)];");
+        print("    }");
+        print();
+        print("    class stub");
+        print("    {");
+        print("    public:");
+        print("        stub(urpc::channel& channel) : channel(channel)");
+        print("        {");
+        print("        }");
+
+        for (int i = 0; i < n; ++i)
+        {
+            auto m = s->method(i);
+
+            auto req = type(m->input_type());
+            auto res = type(m->output_type());
+
+            print();
+            print("        void " + m->name() + "(::google::protobuf::RpcController* controller, const " + req + "* request, " + res + "* response, ::google::protobuf::Closure* done)");
+            print("        {");
+            print("            channel.call(method(id::" + m->name() + "), &name(id::" + m->name() + "), controller, request, response, done);");
+            print("        }");
+            print();
+            print("        decltype(auto) async_" + m->name() + "(urpc::controller& controller, const " + req + "& request, " + res + "& response)");
+            print("        {");
+            print("            return urpc::async_call(*this, &stub::" + m->name() + ", controller, request, response);");
+            print("        }");
+        }
+
+        print();
+        print("    private:");
+        print("        urpc::channel& channel;");
+        print("    };");
+        print();
+        print("    class skeleton : public urpc::skeleton");
+        print("    {");
+        print("    public:");
+
+        for (int i = 0; i < n; ++i)
+        {
+            auto m = s->method(i);
+            print("        virtual void " + m->name() + "(::google::protobuf::RpcController* controller, const " + type(m->input_type()) + "* request, " + type(m->output_type()) + "* response, ::google::protobuf::Closure* done) = 0;");
+        }
+
+        print();
+        print("        const ::google::protobuf::ServiceDescriptor* GetDescriptor()");
+        print("        {");
+        print("            return descriptor();");
+        print("        }");
+        print();
+        print("        uint32_t methods() const");
+        print("        {");
+        print("            return " + std::to_string(n) + ";");
+        print("        }");
+        print();
+        print("        const std::string& method(uint32_t i) const");
+        print("        {");
+        print("            return name(static_cast<id>(i));");
+        print("        }");
+
+        for (auto [fn, kind] : { std::pair("make_request", 0), std::pair("make_response", 1) })
+        {
+            print();
+            print(std::string("        ::google::protobuf::Message* ") + fn + "(uint32_t i) const");
+            print("        {");
+            print("            switch (static_cast<id>(i))");
+            print("            {");
+
+            for (int i = 0; i < n; ++i)
+            {
+                auto m = s->method(i);
+
+                print("                case id::" + m->name() + ":");
+                print("                    return new " + type(kind ? m->output_type() : m->input_type()) + ";");
+            }
+
+            print("            }");
+            print();
+            print("            return nullptr;");
+            print("        }");
+        }
+
+        print();
+        print("        void dispatch(uint32_t i, ::google::protobuf::RpcController* controller, const ::google::protobuf::Message* request, ::google::protobuf::Message* response, ::google::protobuf::Closure* done)");
+        print("        {");
+        print("            switch (static_cast<id>(i))");
+        print("            {");
+
+        for (int i = 0; i < n; ++i)
+        {
+            auto m = s->method(i);
+
+            print("                case id::" + m->name() + ":");
+            print("                    return " + m->name() + "(controller, static_cast<const " + type(m->input_type()) + "*>(request), static_cast<" + type(m->output_type()) + "*>(response), done);");
+        }
+
+        print("            }");
+        print("        }");
+        print("    };");
+        print("};");
+    }
+
+    static std::string generate(const gp::FileDescriptor* file)
+    {
+        std::string out;
+
+        auto& package = file->package();
+        auto g = guard(file->name());
+
+        out += "// Generated by protoc-gen-urpc. DO NOT EDIT!\n";
+        out += "// source: " + file->name() + "\n\n";
+
+        out += "#ifndef " + g + "\n";
+        out += "#define " + g + "\n\n";
+
+        out += "#include <urpc.hpp>\n";
+        out += "#include \"" + base(file->name()) + ".pb.h\"\n\n";
+
+        std::string indent;
+
+        if (!package.empty())
+        {
+            out += "namespace " + scope(package) + "\n{\n";
+            indent = "    ";
+        }
+
+        for (int i = 0; i < file->service_count(); ++i)
+        {
+             if (i)
+                 out += "\n";
+
+             service(out, file->service(i), indent);
+        }
+
+        if (!package.empty())
+            out += "}\n";
+
+        out += "\n#endif\n";
+
+        return out;
+    }
+
+    // the stubs only name message types, proto3 optional fields make no difference to them
+    uint64_t GetSupportedFeatures() const
+    {
+        return FEATURE_PROTO3_OPTIONAL;
+    }
+
+    bool Generate(const gp::FileDescriptor* file, const std::string& parameter, gp::compiler::GeneratorContext* context, std::string* error) const
+    {
+        if (!file->service_count())
+            return true;
+
+        std::unique_ptr<gp::io::ZeroCopyOutputStream> stream(context->Open(base(file->name()) + ".urpc.h"));
+        gp::io::Printer printer(stream.get(), '$');
+
+        printer.PrintRaw(generate(file));
+
+        return !printer.failed();
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    generator g;
+
+    return gp::compiler::PluginMain(argc, argv, &g);
+}
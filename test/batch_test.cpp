@@ -0,0 +1,101 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <string>
+#include <header.hpp>
+#include "check.hpp"
+
+using urpc::batch_reader;
+
+std::string u32(uint32_t n)
+{
+    return std::string(reinterpret_cast<const char*>(&n), sizeof(n));
+}
+
+std::string entry(const std::string& name, const std::string& request)
+{
+    return u32(name.size()) + name + u32(request.size()) + request;
+}
+
+batch_reader reader(const std::string& frame)
+{
+    return batch_reader(frame.data(), frame.data() + frame.size());
+}
+
+// entries come out as they were packed
+void parsed()
+{
+    auto frame = u32(2) + entry("pb.service.ping", "abc") + entry("pb.service.echo", "");
+    auto r = reader(frame);
+
+    uint32_t n;
+    std::string_view name, request;
+
+    CHECK(r.count(n) && n == 2);
+
+    CHECK(r.next(name, request) && name == "pb.service.ping" && request == "abc");
+    CHECK(r.next(name, request) && name == "pb.service.echo" && request.empty());
+
+    CHECK(!r.next(name, request));
+
+    frame = u32(0);
+    CHECK(reader(frame).count(n) && n == 0);
+}
+
+// a count the frame cannot hold is refused before anything is sized by it
+void counts()
+{
+    uint32_t n;
+
+    std::string frame = u32(~0u) + entry("m", "r");
+    CHECK(!reader(frame).count(n));
+
+    frame = u32(2) + entry("", "");
+    CHECK(!reader(frame).count(n));
+
+    frame = u32(1) + entry("", "");
+    CHECK(reader(frame).count(n) && n == 1);
+
+    frame = "ab";
+    CHECK(!reader(frame).count(n));
+
+    CHECK(!batch_reader(nullptr, nullptr).count(n));
+}
+
+// lengths that run past the frame are refused, whichever field they belong to
+void truncated()
+{
+    uint32_t n;
+    std::string_view name, request;
+
+    std::string frame = u32(1) + u32(100) + "m" + u32(0);
+    auto r = reader(frame);
+
+    CHECK(r.count(n) && !r.next(name, request));
+
+    frame = u32(1) + u32(1) + "m" + u32(100) + "r";
+    r = reader(frame);
+
+    CHECK(r.count(n) && !r.next(name, request));
+
+    frame = u32(2) + entry("m", "r") + u32(1) + "m" + "\x01\x00";
+    r = reader(frame);
+
+    CHECK(r.count(n) && n == 2);
+    CHECK(r.next(name, request) && !r.next(name, request));
+}
+
+int main()
+{
+    parsed();
+    counts();
+    truncated();
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <cache.hpp>
+#include "check.hpp"
+
+using urpc::response_cache;
+
+// entries of 10 bytes each in a cache of 30, keyed by their request
+void put(response_cache& c, const std::string& request)
+{
+    c.put(response_cache::hash(request), request, std::string(10 - request.size(), 'r'));
+}
+
+bool has(response_cache& c, const std::string& request)
+{
+    return !!c.get(response_cache::hash(request), request);
+}
+
+// the least recently used entry goes first, a hit counts as a use
+void evicted()
+{
+    response_cache c({ 30, 60000 });
+
+    put(c, "a");
+    put(c, "b");
+    put(c, "c");
+
+    CHECK(c.size() == 3 && c.bytes() == 30);
+    CHECK(has(c, "a"));
+
+    put(c, "d");
+
+    CHECK(c.size() == 3 && c.bytes() == 30);
+    CHECK(!has(c, "b") && has(c, "a") && has(c, "c") && has(c, "d"));
+
+    // a value handed out outlives its eviction
+    auto v = c.get(response_cache::hash("a"), "a");
+
+    put(c, "e");
+    put(c, "f");
+    put(c, "g");
+
+    CHECK(!has(c, "a") && v && *v == std::string(9, 'r'));
+}
+
+// a put for a hash already there replaces it, one larger than the whole cache is not kept
+void replaced()
+{
+    response_cache c({ 30, 60000 });
+
+    put(c, "a");
+    c.put(response_cache::hash("a"), "a", "longer response");
+
+    CHECK(c.size() == 1 && c.bytes() == 16);
+    CHECK(*c.get(response_cache::hash("a"), "a") == "longer response");
+
+    c.put(response_cache::hash("b"), "b", std::string(30, 'x'));
+    CHECK(c.size() == 1 && !has(c, "b"));
+
+    c.clear();
+    CHECK(c.size() == 0 && c.bytes() == 0);
+}
+
+// a colliding hash with other request bytes is a miss, and so is an entry past its ttl
+void misses()
+{
+    response_cache c({ 30, 60000 });
+
+    put(c, "a");
+    CHECK(!c.get(response_cache::hash("a"), "b"));
+
+    response_cache stale({ 30, 0 });
+
+    put(stale, "a");
+    CHECK(!has(stale, "a") && stale.size() == 0 && stale.bytes() == 0);
+
+    CHECK(c.hits() == 0 && c.misses() == 1);
+}
+
+int main()
+{
+    evicted();
+    replaced();
+    misses();
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+#include <cstdlib>
+#include <iostream>
+
+// unlike assert it stays on with NDEBUG, and names the failed condition and where it is
+#define CHECK(cond)                                                                     \
+    do                                                                                  \
+    {                                                                                   \
+        if (!(cond))                                                                    \
+        {                                                                               \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed\n";  \
+            std::exit(1);                                                               \
+        }                                                                               \
+    } while (0)
+
+#endif
@@ -0,0 +1,79 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <stdexcept>
+#include <coro.hpp>
+#include "check.hpp"
+
+struct gate : urpc::suspension
+{
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        return suspend(h);
+    }
+
+    void await_resume() const
+    {
+    }
+};
+
+struct counter : urpc::Closure
+{
+    void Run()
+    {
+        ++runs;
+    }
+
+    int runs = 0;
+};
+
+urpc::task handler(urpc::RpcController* c, const void*, void*, urpc::Closure* done, gate& g, bool fail)
+{
+    co_await g;
+
+    if (fail)
+        throw std::runtime_error("boom");
+
+    done->Run();
+}
+
+// a throw after the first suspension fails the call through its controller instead of unwinding into the resumer
+void resumed()
+{
+    urpc::controller c;
+    counter done;
+    gate g;
+
+    handler(&c, nullptr, nullptr, &done, g, true);
+    CHECK(done.runs == 0);
+
+    g.Run();
+    CHECK(done.runs == 1 && c.Failed());
+    CHECK(c.ErrorText().find("boom") != std::string::npos);
+}
+
+void succeeded()
+{
+    urpc::controller c;
+    counter done;
+    gate g;
+
+    handler(&c, nullptr, nullptr, &done, g, false);
+    g.Run();
+
+    CHECK(done.runs == 1 && !c.Failed());
+}
+
+int main()
+{
+    resumed();
+    succeeded();
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <string>
+#include <vector>
+#include <random>
+#include <crc32c.hpp>
+#include "check.hpp"
+
+// one bit at a time, slow but obviously right
+uint32_t reference(const void* data, size_t n)
+{
+    auto p = static_cast<const unsigned char*>(data);
+    uint32_t crc = ~0u;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+         crc ^= p[i];
+
+         for (int j = 0; j < 8; ++j)
+              crc = crc & 1 ? (crc >> 1) ^ urpc::crc32c_engine::polynomial : crc >> 1;
+    }
+
+    return ~crc;
+}
+
+// the check value of the catalogue and the iSCSI vectors of RFC 3720
+void vectors()
+{
+    std::string check = "123456789";
+    CHECK(urpc::crc32c(check.data(), check.size()) == 0xe3069283);
+
+    std::vector<unsigned char> v(32, 0);
+    CHECK(urpc::crc32c(v.data(), v.size()) == 0x8a9136aa);
+
+    std::fill(v.begin(), v.end(), 0xff);
+    CHECK(urpc::crc32c(v.data(), v.size()) == 0x62a8ab43);
+
+    for (int i = 0; i < 32; ++i)
+         v[i] = i;
+
+    CHECK(urpc::crc32c(v.data(), v.size()) == 0x46dd794e);
+
+    for (int i = 0; i < 32; ++i)
+         v[i] = 31 - i;
+
+    CHECK(urpc::crc32c(v.data(), v.size()) == 0x113fdb5c);
+
+    CHECK(urpc::crc32c(nullptr, 0) == 0);
+}
+
+// every length around the lanes of the interleaved loop, at odd alignments, and continued across buffers
+void lengths()
+{
+    std::mt19937 generator(7);
+    std::vector<unsigned char> data(3 * urpc::crc32c_engine::lane * 2 + 64);
+
+    for (auto& b : data)
+         b = generator();
+
+    for (size_t n : { size_t(1), size_t(7), size_t(8), size_t(63), urpc::crc32c_engine::lane, 3 * urpc::crc32c_engine::lane - 1,
+                      3 * urpc::crc32c_engine::lane, 3 * urpc::crc32c_engine::lane + 9, data.size() - 3 })
+    {
+         for (size_t offset : { 0, 1, 3 })
+         {
+              auto p = data.data() + offset;
+              CHECK(urpc::crc32c(p, n) == reference(p, n));
+
+              auto half = n / 2;
+              CHECK(urpc::crc32c(p + half, n - half, urpc::crc32c(p, half)) == reference(p, n));
+         }
+    }
+}
+
+int main()
+{
+    vectors();
+    lengths();
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <string>
+#include <random>
+#include <delta.hpp>
+#include "check.hpp"
+
+std::string noise(std::mt19937& generator, size_t n)
+{
+    std::string s(n, 0);
+
+    for (auto& c : s)
+         c = generator();
+
+    return s;
+}
+
+// a window slid a byte at a time sums as one computed over it afresh
+void rolled()
+{
+    std::mt19937 generator(1);
+    auto data = noise(generator, 1000);
+
+    uint32_t n = 64;
+    urpc::rolling weak(data.data(), n);
+
+    for (size_t i = 0; i + n < data.size(); ++i)
+    {
+         weak.roll(data[i], data[i + n]);
+         CHECK(weak.value() == urpc::rolling(data.data() + i + 1, n).value());
+    }
+}
+
+// rebuilds the new copy from the old one and what delta emits, counting the bytes that had to be sent
+std::string patch(const std::string& from, const std::string& to, uint32_t block, size_t& literals)
+{
+    urpc::signatures sigs(block);
+
+    urpc::sign(from.data(), from.size(), block, [&](uint32_t weak, const std::string& strong)
+    {
+        sigs.add(weak, strong);
+    });
+
+    std::string out;
+    literals = 0;
+
+    urpc::delta d(to.data(), to.size(), sigs);
+
+    auto literal = [&](const char* p, size_t n)
+    {
+        out.append(p, n);
+        literals += n;
+    };
+
+    auto copy = [&](uint64_t i, const char*)
+    {
+        out.append(from, i * block, block);
+    };
+
+    while (d.next(256, 1024, literal, copy))
+        ;
+
+    return out;
+}
+
+void round_trip()
+{
+    std::mt19937 generator(2);
+
+    uint32_t block = 64;
+    auto from = noise(generator, 64 * 100 + 17);
+
+    size_t literals;
+
+    // unchanged, only the trailing partial block goes as literal
+    CHECK(patch(from, from, block, literals) == from && literals == 17);
+
+    // an insertion shifts everything after it, the blocks are still found off their boundaries
+    auto to = from;
+    to.insert(1000, "inserted bytes");
+    to.replace(4000, 10, noise(generator, 10));
+    to.erase(5000, 3);
+
+    CHECK(patch(from, to, block, literals) == to);
+    CHECK(literals < 6 * block);
+
+    // nothing in common, all of it is literal
+    auto other = noise(generator, 3000);
+
+    CHECK(patch(from, other, block, literals) == other && literals == other.size());
+
+    // an empty old copy has no signatures to match
+    CHECK(patch({}, to, block, literals) == to && literals == to.size());
+    CHECK(patch(from, {}, block, literals).empty());
+}
+
+int main()
+{
+    rolled();
+    round_trip();
+
+    return 0;
+}
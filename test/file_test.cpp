@@ -0,0 +1,203 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <file.hpp>
+#include "check.hpp"
+
+namespace net = unp;
+
+using urpc::file_ring;
+
+// the tests reap by hand, the loop that would do it is not running
+template <typename F>
+void until(file_ring& r, F&& f)
+{
+    while (!f())
+        r.reap();
+}
+
+std::string scratch()
+{
+    char path[] = "/tmp/urpc_file_XXXXXX";
+    CHECK(::mkdtemp(path));
+
+    return path;
+}
+
+// a file goes through the usual life cycle, every result as io_uring reports it
+void operations(net::io_uring_context& ioc, const std::string& dir)
+{
+    auto r = file_ring::of(ioc);
+    CHECK(file_ring::of(ioc) == r);
+
+    std::string data(1 << 20, 'x');
+    std::string name = dir + "/a/b/c/f";
+
+    int fd = -1;
+    int step = 0;
+
+    struct statx st {};
+
+    r->mkdirs(dir + "/a/b/c", 0755, [&](int res)
+    {
+        CHECK(res == 0);
+
+        r->openat(AT_FDCWD, name, O_WRONLY | O_CREAT | O_TRUNC, 0644, [&](int res)
+        {
+            CHECK(res >= 0);
+            fd = res;
+
+            r->write_all(fd, data.data(), data.size(), 0, [&](int res)
+            {
+                CHECK(res == 0);
+
+                r->fsync(fd, true, [&](int res)
+                {
+                    CHECK(res == 0);
+
+                    r->close(fd, [&](int res)
+                    {
+                        CHECK(res == 0);
+
+                        r->statx(AT_FDCWD, name, 0, STATX_SIZE, &st, [&](int res)
+                        {
+                            CHECK(res == 0 && st.stx_size == data.size());
+
+                            r->renameat(AT_FDCWD, name, AT_FDCWD, dir + "/g", [&](int res)
+                            {
+                                CHECK(res == 0);
+
+                                r->unlinkat(AT_FDCWD, dir + "/g", 0, [&](int res)
+                                {
+                                    CHECK(res == 0);
+                                    step = 1;
+                                });
+                            });
+                        });
+                    });
+                });
+            });
+        });
+    });
+
+    until(*r, [&]{ return step == 1; });
+    CHECK(r->pending() == 0);
+
+    r->openat(AT_FDCWD, dir + "/missing/f", O_RDONLY, 0, [&](int res)
+    {
+        CHECK(res == -ENOENT);
+        step = 2;
+    });
+
+    until(*r, [&]{ return step == 2; });
+}
+
+// far more operations than the queues hold, submitted from the handlers of earlier ones: a submission that has
+// to make room only harvests completions, so no handler runs inside a submit, and each runs exactly once
+void flood(net::io_uring_context& ioc, const std::string& dir)
+{
+    auto r = std::make_shared<file_ring>(ioc, 4);
+
+    constexpr int total = 1000;
+
+    std::vector<int> runs(total);
+    std::vector<struct statx> st(total);
+
+    bool submitting = false;
+    int next = 0;
+
+    std::function<void()> one = [&]
+    {
+        int i = next++;
+
+        submitting = true;
+
+        r->statx(AT_FDCWD, dir, 0, STATX_SIZE, &st[i], [&, i](int res)
+        {
+            CHECK(!submitting && res == 0);
+            ++runs[i];
+
+            if (next < total)
+                one();
+        });
+
+        submitting = false;
+    };
+
+    // no reaping in between, the completion queue overflows into the kernel
+    while (next < total / 2)
+        one();
+
+    until(*r, [&]{ return r->pending() == 0; });
+
+    for (auto n : runs)
+         CHECK(n == 1);
+}
+
+// the ring stays while an operation is in flight even with no one holding it, and goes after its handler
+void lifetime(net::io_uring_context& ioc, const std::string& dir)
+{
+    auto r = file_ring::of(ioc);
+    auto p = r.get();
+
+    std::weak_ptr<file_ring> w = r;
+
+    struct statx st {};
+    bool done = false;
+
+    r->statx(AT_FDCWD, dir, 0, STATX_SIZE, &st, [&](int res)
+    {
+        done = true;
+    });
+
+    r.reset();
+    CHECK(!w.expired());
+
+    while (!done)
+    {
+        if (auto x = w.lock())
+            x->reap();
+    }
+
+    CHECK(w.expired());
+
+    r = file_ring::of(ioc);
+    CHECK(r && r.get() != p);
+}
+
+// a controller that runs on no loop has no ring, the awaiters fail instead of touching one
+void unbound(net::io_uring_context& ioc)
+{
+    urpc::controller c;
+    CHECK(!urpc::files(&c));
+
+    c.ring(&ioc);
+    CHECK(urpc::files(&c));
+}
+
+int main()
+{
+    net::io_uring_context ioc;
+    auto dir = scratch();
+
+    operations(ioc, dir);
+    flood(ioc, dir);
+    lifetime(ioc, dir);
+    unbound(ioc);
+
+    ::rmdir((dir + "/a/b/c").c_str());
+    ::rmdir((dir + "/a/b").c_str());
+    ::rmdir((dir + "/a").c_str());
+    ::rmdir(dir.c_str());
+
+    return 0;
+}
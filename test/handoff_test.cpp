@@ -0,0 +1,69 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <chrono>
+#include <handoff.hpp>
+#include "check.hpp"
+
+// the fd and its tag arrive together, a byte without an fd is refused
+void passed()
+{
+    int sv[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+    CHECK(urpc::send_fd(sv[0], STDIN_FILENO, 's'));
+
+    char tag = 0;
+    int fd = urpc::recv_fd(sv[1], tag);
+
+    CHECK(fd != -1 && tag == 's');
+    ::close(fd);
+
+    CHECK(::send(sv[0], "x", 1, 0) == 1);
+    CHECK(urpc::recv_fd(sv[1], tag) == -1 && errno == EPROTO);
+
+    CHECK(urpc::recv_fd(sv[1], tag, MSG_DONTWAIT) == -1 && errno == EAGAIN);
+
+    ::close(sv[0]);
+    CHECK(urpc::recv_fd(sv[1], tag) == -1 && errno == ECONNRESET);
+
+    ::close(sv[1]);
+}
+
+// a server that accepts but never answers costs the new one its timeout, not its start
+void silent()
+{
+    std::string path = "@urpc.handoff_test." + std::to_string(::getpid());
+
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path + 1, path.data() + 1, path.size() - 1);
+
+    int s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+    CHECK(::bind(s, reinterpret_cast<sockaddr*>(&addr), offsetof(sockaddr_un, sun_path) + path.size()) == 0);
+    CHECK(::listen(s, 1) == 0);
+
+    auto start = std::chrono::steady_clock::now();
+    auto from = urpc::inherit(path, 50);
+
+    CHECK(!from);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+
+    ::close(s);
+    CHECK(!urpc::inherit(path, 50));
+}
+
+int main()
+{
+    passed();
+    silent();
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <limiter.hpp>
+#include "check.hpp"
+
+using namespace std::chrono_literals;
+
+void samples(urpc::limiter& l, std::chrono::nanoseconds rtt, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; ++i)
+    {
+         CHECK(l.acquire());
+         l.release(rtt);
+    }
+}
+
+// slots up to the limit, every one past it is rejected and counted
+void slots()
+{
+    urpc::limiter_options options;
+    options.initial = 3;
+
+    urpc::limiter l(options);
+
+    CHECK(l.acquire() && l.acquire() && l.acquire());
+    CHECK(!l.acquire() && !l.acquire());
+    CHECK(l.inflight() == 3 && l.rejected() == 2);
+
+    l.release();
+    CHECK(l.acquire());
+
+    for (int i = 0; i < 5; ++i)
+         l.release();
+
+    CHECK(l.inflight() == 0);
+}
+
+// the limit grows while latency holds at its baseline, shrinks once it rises well above it, and stays in bounds
+void adaptive()
+{
+    urpc::limiter_options options;
+    options.initial = 20;
+    options.max = 100;
+    options.window = 8;
+
+    urpc::limiter l(options);
+
+    samples(l, 1ms, 8 * 80);
+    CHECK(l.limit() == 100);
+
+    auto before = l.limit();
+    samples(l, 10ms, 8 * 3);
+
+    CHECK(l.limit() < before);
+
+    samples(l, 10s, 8 * 200);
+    CHECK(l.limit() >= options.min);
+
+    // a partial window changes nothing
+    before = l.limit();
+    samples(l, 1ms, 7);
+
+    CHECK(l.limit() == before);
+}
+
+// a new configuration clamps the limit and leaves the calls in flight alone
+void reconfigured()
+{
+    urpc::limiter l;
+
+    CHECK(l.acquire() && l.acquire());
+
+    urpc::limiter_options options;
+    options.min = 1;
+    options.max = 1;
+
+    l.configure(options);
+
+    CHECK(l.limit() == 1 && l.inflight() == 2);
+    CHECK(!l.acquire());
+
+    l.release();
+    l.release();
+
+    CHECK(l.acquire());
+}
+
+int main()
+{
+    slots();
+    adaptive();
+    reconfigured();
+
+    return 0;
+}
@@ -0,0 +1,58 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <monitor.hpp>
+#include "check.hpp"
+
+namespace net = unp;
+
+using urpc::loop_monitor;
+
+// one monitor per loop while anything holds it, a fresh one once the last holder is gone
+void shared()
+{
+    net::io_uring_context ioc;
+
+    auto m = loop_monitor::of(ioc);
+    CHECK(loop_monitor::of(ioc) == m);
+
+    std::weak_ptr<loop_monitor> w = m;
+    m.reset();
+
+    CHECK(w.expired());
+    CHECK(loop_monitor::of(ioc)->stats().submissions == 0);
+}
+
+// a pending completion keeps the monitor it is counted against
+void pending()
+{
+    net::io_uring_context ioc;
+
+    int runs = 0;
+    auto m = loop_monitor::of(ioc);
+
+    auto f = m->wrap("pending", [&]{ ++runs; });
+    std::weak_ptr<loop_monitor> w = m;
+
+    CHECK(m->stats().inflight == 1);
+    m.reset();
+
+    CHECK(!w.expired());
+    f();
+
+    CHECK(runs == 1 && w.lock()->stats().completions == 1);
+}
+
+int main()
+{
+    shared();
+    pending();
+
+    return 0;
+}
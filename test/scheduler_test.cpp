@@ -0,0 +1,124 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <string>
+#include <algorithm>
+#include <scheduler.hpp>
+#include "check.hpp"
+
+using scheduler_t = urpc::scheduler<std::string>;
+
+std::string drain(scheduler_t& s)
+{
+    std::string order;
+
+    while (!s.empty())
+        order += s.pop();
+
+    return order;
+}
+
+// a connection that queued first and most does not hold back the others within its class
+void round_robin()
+{
+    urpc::scheduler_options options;
+    options.quantum = 100;
+
+    scheduler_t s(options);
+
+    for (int i = 0; i < 4; ++i)
+         s.push(0, 1, "a", 100);
+
+    s.push(0, 2, "b", 100);
+    s.push(0, 2, "b", 100);
+
+    CHECK(s.size() == 6);
+    CHECK(drain(s) == "ababaa");
+}
+
+// a flow spends its deficit on small items before the next one gets a turn
+void deficit()
+{
+    urpc::scheduler_options options;
+    options.quantum = 100;
+
+    scheduler_t s(options);
+
+    for (int i = 0; i < 4; ++i)
+         s.push(0, 1, "a", 50);
+
+    s.push(0, 2, "b", 100);
+    s.push(0, 2, "b", 100);
+
+    CHECK(drain(s) == "aabaab");
+}
+
+// classes share the dispatched cost by weight, not by how much each has queued
+void weighted()
+{
+    urpc::scheduler_options options;
+    options.weights = { 2, 1 };
+
+    scheduler_t s(options);
+
+    for (int i = 0; i < 6; ++i)
+    {
+         s.push(0, 1, "0", 100);
+         s.push(1, 2, "1", 100);
+    }
+
+    auto first = drain(s).substr(0, 9);
+    CHECK(std::count(first.begin(), first.end(), '0') == 6);
+}
+
+void dropped()
+{
+    scheduler_t s({});
+
+    s.push(0, 1, "a", 1);
+    s.push(1, 1, "c", 1);
+    s.push(0, 2, "b", 1);
+
+    auto items = s.drop(1);
+
+    CHECK(items.size() == 2 && s.size() == 1);
+    CHECK(drain(s) == "b");
+    CHECK(s.drop(1).empty());
+}
+
+// fewer classes fold what was queued into the last one, nothing is lost
+void reconfigured()
+{
+    scheduler_t s({});
+
+    s.push(0, 1, "a", 1);
+    s.push(2, 2, "c", 1);
+    s.push(1, 3, "b", 1);
+
+    urpc::scheduler_options options;
+    options.weights = { 1 };
+    options.concurrency = 8;
+
+    s.configure(options);
+
+    CHECK(s.classes() == 1 && s.size() == 3);
+    CHECK(s.config().concurrency == 8);
+    CHECK(drain(s).size() == 3);
+}
+
+int main()
+{
+    round_robin();
+    deficit();
+    weighted();
+    dropped();
+    reconfigured();
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <memory>
+#include <string>
+#include <shm.hpp>
+#include "check.hpp"
+
+using urpc::shm_ring;
+
+struct ring_t
+{
+    ring_t() : storage(static_cast<char*>(std::aligned_alloc(64, sizeof(shm_ring) + shm_ring::capacity)))
+    {
+        ring = new (storage.get()) shm_ring { {0}, {0}, {0}, {0} };
+    }
+
+    struct deleter
+    {
+        void operator()(char* p) const
+        {
+            std::free(p);
+        }
+    };
+
+    std::unique_ptr<char, deleter> storage;
+    shm_ring* ring;
+};
+
+// bytes come out in order across the wrap, a full ring takes nothing more
+void round_trip()
+{
+    ring_t r;
+    auto ring = r.ring;
+
+    ring->head = shm_ring::capacity - 3;
+    ring->tail = shm_ring::capacity - 3;
+
+    std::string in = "wrapped around";
+    CHECK(ring->produce(in.data(), in.size()) == int64_t(in.size()));
+    CHECK(ring->readable());
+
+    std::string out(in.size(), 0);
+    CHECK(ring->consume(out.data(), out.size()) == int64_t(out.size()));
+    CHECK(out == in && !ring->readable());
+
+    std::string big(shm_ring::capacity + 10, 'x');
+    CHECK(ring->produce(big.data(), big.size()) == int64_t(shm_ring::capacity));
+    CHECK(!ring->writable() && ring->produce(big.data(), 1) == 0);
+}
+
+// indices a peer forged are refused before they are used to copy anything
+void forged()
+{
+    ring_t r;
+    auto ring = r.ring;
+
+    char buff[16] {};
+
+    ring->head = 0;
+    ring->tail = shm_ring::capacity + 1;
+
+    CHECK(ring->consume(buff, sizeof(buff)) == -EPROTO);
+    CHECK(ring->produce(buff, sizeof(buff)) == -EPROTO);
+
+    ring->head = 100;
+    ring->tail = 10;
+
+    CHECK(ring->consume(buff, sizeof(buff)) == -EPROTO);
+    CHECK(ring->produce(buff, sizeof(buff)) == -EPROTO);
+
+    ring->head = 7;
+    ring->tail = 7 + shm_ring::capacity;
+
+    CHECK(ring->produce(buff, sizeof(buff)) == 0);
+    CHECK(ring->consume(buff, sizeof(buff)) == int64_t(sizeof(buff)));
+}
+
+int main()
+{
+    round_trip();
+    forged();
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+//
+// Copyright (c) 2023-present DeepGrace (complex dot invoke at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/deepgrace/urpc
+//
+
+#include <tls.hpp>
+#include "check.hpp"
+
+// without a ca a client still checks the server, against the system store, unless told not to
+void verified()
+{
+    urpc::tls_options options;
+
+    urpc::tls_context client(options, false);
+    CHECK(SSL_CTX_get_verify_mode(client.native_handle()) & SSL_VERIFY_PEER);
+
+    options.verify = false;
+
+    urpc::tls_context trusting(options, false);
+    CHECK(SSL_CTX_get_verify_mode(trusting.native_handle()) == SSL_VERIFY_NONE);
+}
+
+// a server asks for client certificates only with a ca to check them against
+void server()
+{
+    urpc::tls_options options;
+
+    urpc::tls_context context(options, true);
+    CHECK(SSL_CTX_get_verify_mode(context.native_handle()) == SSL_VERIFY_NONE);
+}
+
+int main()
+{
+    verified();
+    server();
+
+    return 0;
+}